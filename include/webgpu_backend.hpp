@@ -11,6 +11,7 @@
 #ifdef IS_CUDA_BUILD
 #include <c10/cuda/CUDAStream.h>
 #include <ATen/cuda/CUDAEvent.h>
+#include <cuda_runtime_api.h>
 #include <c10/cuda/CUDAGuard.h>
 #endif
 #include <c10/util/irange.h>
@@ -28,13 +29,144 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 
-#define SIZE_OF_CHUNK 128
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "webgpu_listener_client.hpp"
+#include "webgpu_trace/webgpu_trace.hpp"
+
 #define QUANTIZATION_SCALE 10000.0f
+#define STAGING_MIN_SIZE_CLASS (64 * 1024)
+#define STAGING_ALIGNMENT 256
+#define STAGING_DEFAULT_CAPACITY_MB 512
+#define DEFAULT_GLOO_CROSSOVER_BYTES (16 * 1024)
+#define TOPK_MAX_RESIDUALS 1024
 #define USE_CUDA_IF_AVAILABLE "USE_CUDA_IF_AVAILABLE"
 
 namespace c10d
 {
 
+    // Keeps only the largest-magnitude `ratio` fraction of each gradient and
+    // carries the dropped remainder over to the next call on the same
+    // bucket (error feedback), so no update is lost, only delayed.
+    class TopKSparsifier
+    {
+    public:
+        void set_ratio(float ratio);
+        float ratio();
+
+        // `bucket` is the caller's stable identity for the gradient bucket,
+        // e.g. the DDP bucket index, and `buffer` the tensor holding it. A
+        // residual is discarded once its buffer is freed or replaced.
+        void sparsify(int64_t bucket, const at::Tensor &buffer, std::vector<float> &data);
+
+    private:
+        struct Residual
+        {
+            c10::weak_intrusive_ptr<c10::TensorImpl, c10::UndefinedTensorImpl> buffer;
+            std::vector<float> values;
+            uint64_t last_use = 0;
+        };
+
+        // Drops residuals of freed buffers, then the least recently used
+        // ones, until a new bucket fits under TOPK_MAX_RESIDUALS.
+        void make_room();
+
+        float m_ratio = 0.0f;
+        uint64_t m_calls = 0;
+        std::mutex m_mutex;
+        std::unordered_map<int64_t, Residual> m_residuals;
+    };
+
+    enum class AllreduceAlgorithm
+    {
+        LISTENER,
+        GLOO,
+    };
+
+    // Routes each allreduce to the inherited Gloo ring/halving-doubling
+    // implementation or to the listener aggregation path. Messages smaller
+    // than the crossover for the current world size go to Gloo. The table
+    // must be identical on every rank, otherwise ranks would disagree on the
+    // path and deadlock; calibrate() guarantees that by agreeing on timings.
+    class AllreduceAlgorithmSelector
+    {
+    public:
+        AllreduceAlgorithm select(size_t bytes, int world_size);
+        void count(AllreduceAlgorithm algorithm, size_t bytes);
+
+        // Uses the entry for the largest configured world size not above
+        // `world_size`, or DEFAULT_GLOO_CROSSOVER_BYTES when there is none.
+        void set_crossover(int world_size, size_t bytes);
+        void clear();
+        std::map<int, size_t> crossover_table();
+
+        size_t calls(AllreduceAlgorithm algorithm) const;
+        size_t bytes(AllreduceAlgorithm algorithm) const;
+
+    private:
+        std::mutex m_mutex;
+        std::map<int, size_t> m_crossover;
+        std::atomic<size_t> m_calls[2] = {};
+        std::atomic<size_t> m_bytes[2] = {};
+    };
+
+#ifdef IS_CUDA_BUILD
+    // Reusable page-locked host memory for staging device tensors. Blocks
+    // come in power-of-two size classes and are only handed out again once
+    // the copies recorded against them have completed, so steady-state
+    // allreduce does no pinned allocations. Beyond `capacity_bytes` idle
+    // blocks are evicted, and if that is not enough the request falls back
+    // to pageable memory. Blocks are allocated with cudaHostAlloc rather than
+    // PyTorch's caching host allocator, so evicting them frees only this
+    // pool's memory.
+    class PinnedStagingPool
+    {
+    public:
+        struct Block
+        {
+            c10::Storage storage;
+            size_t size_class;
+            bool pinned;
+            // Recorded on the streams that used the block when it was released.
+            std::vector<c10::Event> pending;
+        };
+
+        explicit PinnedStagingPool(size_t capacity_bytes);
+
+        std::unique_ptr<Block> acquire(size_t bytes);
+        void release(std::unique_ptr<Block> block, const std::vector<c10::Stream> &streams);
+
+        size_t pinned_allocations();
+        size_t pinned_bytes();
+        size_t pageable_fallbacks();
+
+    private:
+        struct PinnedAllocation
+        {
+            PinnedStagingPool *pool;
+            size_t bytes;
+            void *data;
+        };
+
+        static bool is_idle(const Block &block);
+        void evict_idle_blocks(size_t bytes_needed);
+        // Deleter of pinned storage. Returns the bytes whenever a block goes
+        // away, including one a failed allreduce never released.
+        static void free_pinned(void *context);
+
+        std::mutex m_mutex;
+        size_t m_capacity;
+        std::atomic<size_t> m_pinned_bytes{0};
+        size_t m_pinned_allocations = 0;
+        size_t m_pageable_fallbacks = 0;
+        std::map<size_t, std::vector<std::unique_ptr<Block>>> m_free;
+    };
+#endif
+
     class WebGPUBackend : public ProcessGroupGloo
     {
     public:
@@ -51,6 +183,87 @@ namespace c10d
             std::vector<at::Tensor> &tensors,
             const AllreduceOptions &opts = AllreduceOptions()) override;
 
+        // The remaining collectives are Gloo's, overridden only so they can
+        // be traced.
+        c10::intrusive_ptr<Work> broadcast(
+            std::vector<at::Tensor> &tensors,
+            const BroadcastOptions &opts = BroadcastOptions()) override;
+
+        c10::intrusive_ptr<Work> reduce(
+            std::vector<at::Tensor> &tensors,
+            const ReduceOptions &opts = ReduceOptions()) override;
+
+        c10::intrusive_ptr<Work> allgather(
+            std::vector<std::vector<at::Tensor>> &outputs,
+            std::vector<at::Tensor> &inputs,
+            const AllgatherOptions &opts = AllgatherOptions()) override;
+
+        c10::intrusive_ptr<Work> reduce_scatter(
+            std::vector<at::Tensor> &outputs,
+            std::vector<std::vector<at::Tensor>> &inputs,
+            const ReduceScatterOptions &opts = ReduceScatterOptions()) override;
+
+        c10::intrusive_ptr<Work> barrier(
+            const BarrierOptions &opts = BarrierOptions()) override;
+
+        c10::intrusive_ptr<Work> allreduce_coalesced(
+            std::vector<at::Tensor> &tensors,
+            const AllreduceCoalescedOptions &opts = AllreduceCoalescedOptions()) override;
+
+        c10::intrusive_ptr<Work> _allgather_base(
+            at::Tensor &outputBuffer,
+            at::Tensor &inputBuffer,
+            const AllgatherOptions &opts = AllgatherOptions()) override;
+
+        c10::intrusive_ptr<Work> allgather_coalesced(
+            std::vector<std::vector<at::Tensor>> &outputTensorLists,
+            std::vector<at::Tensor> &inputTensors,
+            const AllgatherOptions &opts = AllgatherOptions()) override;
+
+        c10::intrusive_ptr<Work> _reduce_scatter_base(
+            at::Tensor &outputTensor,
+            at::Tensor &inputTensor,
+            const ReduceScatterOptions &opts = ReduceScatterOptions()) override;
+
+        c10::intrusive_ptr<Work> alltoall_base(
+            at::Tensor &outputTensor,
+            at::Tensor &inputTensor,
+            std::vector<int64_t> &outputCounts,
+            std::vector<int64_t> &inputCounts,
+            const AllToAllOptions &opts = AllToAllOptions()) override;
+
+        c10::intrusive_ptr<Work> gather(
+            std::vector<std::vector<at::Tensor>> &outputs,
+            std::vector<at::Tensor> &inputs,
+            const GatherOptions &opts = GatherOptions()) override;
+
+        c10::intrusive_ptr<Work> scatter(
+            std::vector<at::Tensor> &outputs,
+            std::vector<std::vector<at::Tensor>> &inputs,
+            const ScatterOptions &opts = ScatterOptions()) override;
+
+        // Gloo's point-to-point work has no future, so these are recorded
+        // when they are issued.
+        c10::intrusive_ptr<Work> send(
+            std::vector<at::Tensor> &tensors,
+            int dstRank,
+            int tag) override;
+
+        c10::intrusive_ptr<Work> recv(
+            std::vector<at::Tensor> &tensors,
+            int srcRank,
+            int tag) override;
+
+        c10::intrusive_ptr<Work> recvAnysource(
+            std::vector<at::Tensor> &tensors,
+            int tag) override;
+
+        // Always aggregates through the listener, bypassing algorithm
+        // selection. A non-negative `sparsify_bucket` applies top-k
+        // sparsification with error feedback kept under that bucket.
+        c10::intrusive_ptr<Work> allreduce_listener(
+            std::vector<at::Tensor> &tensors, int64_t sparsify_bucket = -1);
+
         c10::intrusive_ptr<Work> allreduce_with_quantization(
                 std::vector<at::Tensor> &tensors,
                 const AllreduceOptions &opts = AllreduceOptions());
@@ -58,7 +271,36 @@ namespace c10d
         void configure_backend(bool use_quantization,
             bool use_scaling, bool straggler_aware);
 
-        static c10::intrusive_ptr<Backend> createIncBackend(
+        // A ratio in (0, 1) enables top-k sparsification of the allreduces
+        // that opt in with a bucket, 0 disables it.
+        void configure_sparsification(float topk_ratio);
+
+        // Records every collective and point-to-point call of this rank to
+        // `path` until disable_trace() is called. Collectives run by Gloo
+        // are recorded when they complete. Not safe to call while
+        // collectives are in flight.
+        void enable_trace(const std::string &path);
+
+        // Top-k sparsified listener allreduce of one gradient bucket, see
+        // TopKSparsifier. Blocks until the result is in `tensor`.
+        void sparse_allreduce(at::Tensor &tensor, int64_t bucket);
+
+        // Times both allreduce paths for each message size and stores the
+        // crossover for the current world size. Collective: every rank must
+        // call it with the same arguments.
+        void calibrate_algorithm_selection(const std::vector<size_t> &message_bytes,
+            int iterations, const at::Device &device);
+
+        AllreduceAlgorithmSelector &algorithm_selector() { return m_algorithm_selector; }
+        void disable_trace();
+
+        ShardedListenerClient &listener_client() { return *m_listener_client; }
+        TopKSparsifier &sparsifier() { return m_sparsifier; }
+#ifdef IS_CUDA_BUILD
+        PinnedStagingPool &staging_pool() { return m_staging_pool; }
+#endif
+
+        static c10::intrusive_ptr<Backend> createWebGPUBackend(
             const c10::intrusive_ptr<::c10d::Store> &store,
             int rank,
             int size,
@@ -75,6 +317,21 @@ namespace c10d
         const std::string getBackendName() const override {
             return "webgpu_backend";
         }
+
+    private:
+        std::unique_ptr<ShardedListenerClient> m_listener_client;
+        TopKSparsifier m_sparsifier;
+        AllreduceAlgorithmSelector m_algorithm_selector;
+        // Shared with the completion callbacks of traced Gloo work.
+        std::shared_ptr<CollectiveTraceRecorder> m_trace_recorder;
+#ifdef IS_CUDA_BUILD
+        PinnedStagingPool m_staging_pool;
+#endif
+
+        // Records the collective now, or when `gloo_work` completes.
+        void record_collective(OpType op, const std::vector<at::Tensor> &tensors,
+            std::chrono::steady_clock::time_point start,
+            const c10::intrusive_ptr<Work> &gloo_work = nullptr);
     };
 
     class WebGPUBackendWork : public Work
@@ -83,7 +340,8 @@ namespace c10d
 
     public:
         WebGPUBackendWork(OpType opType, std::vector<at::Tensor> &tensors, 
-            int rank, int world_size, c10::intrusive_ptr<c10::ivalue::Future> future);
+            int rank, int world_size, WebGPUBackend *backend,
+            c10::intrusive_ptr<c10::ivalue::Future> future, int64_t sparsify_bucket = -1);
 
         void run();
         bool isCompleted() override;
@@ -99,8 +357,14 @@ namespace c10d
         std::vector<c10::Stream> streams_;
         std::vector<c10::Event> events_;
         bool on_cuda_;
+#ifdef IS_CUDA_BUILD
+        // Contiguous pinned region backing every entry of host_tensors_.
+        std::unique_ptr<PinnedStagingPool::Block> staging_block_;
+#endif
 
         int m_rank;
         int m_world_size;
+        WebGPUBackend *m_backend;
+        int64_t m_sparsify_bucket;
     };
 }
\ No newline at end of file
@@ -1,34 +1,136 @@
 #pragma once
 
 #include <vector>
+#include <cstdint>
 #include <webgpu/webgpu.h>
 #include <iostream>
 #include <string>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+
+#define DEFAULT_MAX_IN_FLIGHT 3
+
+// Non-zero entries of one contribution. Indices may repeat and need not be
+// sorted.
+struct SparseContribution {
+    std::vector<uint32_t> indices;
+    std::vector<float> values;
+};
 
 class WebGPUCompute {
 public:
-    WebGPUCompute();
+    // Invoked from the poll thread once the reduction has been read back.
+    // On failure `result` is empty and `error` holds the reason.
+    using AggregationCallback = std::function<void(std::vector<float> result, std::exception_ptr error)>;
+
+    WebGPUCompute(size_t max_in_flight = DEFAULT_MAX_IN_FLIGHT);
+    ~WebGPUCompute();
+
     std::vector<float> perform_aggregation(std::vector<std::vector<float>> data);
 
+    // Submits the reduction and returns immediately. Blocks only when all
+    // `max_in_flight` slots are still owned by earlier submissions.
+    std::future<std::vector<float>> perform_aggregation_async(std::vector<std::vector<float>> data);
+    void perform_aggregation_async(std::vector<std::vector<float>> data, AggregationCallback on_complete);
+
+    // Reduces a mix of dense and sparse contributions into a dense result of
+    // `length` floats. Dense inputs are summed first, then the sparse entries
+    // are merged by a segmented scatter-add in the same submission.
+    void perform_sparse_aggregation_async(size_t length,
+        std::vector<std::vector<float>> dense,
+        std::vector<SparseContribution> sparse,
+        AggregationCallback on_complete);
+
+    // Waits until the callbacks of every submission made so far have run.
+    void drain();
+
 private:
-    void webgpu_vector_addition(std::vector<float>& a, std::vector<float>& b, std::vector<float>& result);
+    // One set of GPU resources per in-flight reduction, reused across calls
+    // and only reallocated when a larger payload arrives.
+    struct InFlightSlot {
+        WebGPUCompute* owner = nullptr;
+        WGPUBuffer inputBuffer = nullptr;
+        WGPUBuffer paramsBuffer = nullptr;
+        WGPUBuffer bufferResult = nullptr;
+        WGPUBuffer stagingBuffer = nullptr;
+        WGPUBuffer sparseBuffer = nullptr;
+        WGPUBindGroup bindGroup = nullptr;
+        WGPUBindGroup scatterBindGroup = nullptr;
+        size_t inputCapacity = 0;
+        size_t resultCapacity = 0;
+        size_t sparseCapacity = 0;
+
+        size_t length = 0;
+        bool busy = false;
+        bool mapped = false;
+        WGPUBufferMapAsyncStatus mapStatus = WGPUBufferMapAsyncStatus_Unknown;
+        AggregationCallback on_complete;
+    };
+
+    InFlightSlot& acquire_slot();
+    void submit(InFlightSlot& slot, size_t length,
+        const std::vector<std::vector<float>>& dense,
+        const std::vector<uint32_t>& sparse, uint32_t segments);
+    void complete(InFlightSlot& slot);
+    void poll_loop();
     void cleanup();
-    
-    void create_bind_group();
+
+    void create_bind_group(InFlightSlot& slot);
     void initialize_pipeline();
-    void create_buffers(std::vector<float>& a, std::vector<float>& b);
+    void create_buffers(InFlightSlot& slot, size_t inputSize, size_t resultSize, size_t sparseSize);
+    void release_buffers(InFlightSlot& slot);
     void initialize_device();
 
+    // `main` sums `params.contributions` vectors of `params.length` floats
+    // that are laid out back to back in `contributions`, so a whole round is
+    // reduced by a single dispatch.
+    //
+    // `scatter_add` then merges sparse entries grouped by destination index.
+    // `sparse` holds the segment indices, the `segments + 1` segment offsets
+    // and the value bits, so every thread owns a distinct output element and
+    // no atomics are needed.
     const char* shaderCode = R"(
-        @group(0) @binding(0) var<storage, read> a: array<f32>;
-        @group(0) @binding(1) var<storage, read> b: array<f32>;
+        struct Params {
+            length: u32,
+            contributions: u32,
+            segments: u32,
+            entries: u32,
+        };
+
+        @group(0) @binding(0) var<storage, read> contributions: array<f32>;
+        @group(0) @binding(1) var<uniform> params: Params;
         @group(0) @binding(2) var<storage, read_write> result: array<f32>;
-        
+        @group(0) @binding(3) var<storage, read> sparse: array<u32>;
+
         @compute @workgroup_size(64)
         fn main(@builtin(global_invocation_id) global_id: vec3<u32>) {
             let index = global_id.x;
-            if (index < arrayLength(&a)) {
-                result[index] = a[index] + b[index];
+            if (index < params.length) {
+                var sum = 0.0;
+                for (var k = 0u; k < params.contributions; k = k + 1u) {
+                    sum = sum + contributions[k * params.length + index];
+                }
+                result[index] = sum;
+            }
+        }
+
+        @compute @workgroup_size(64)
+        fn scatter_add(@builtin(global_invocation_id) global_id: vec3<u32>) {
+            let segment = global_id.x;
+            if (segment < params.segments) {
+                let index = sparse[segment];
+                let begin = sparse[params.segments + segment];
+                let end = sparse[params.segments + segment + 1u];
+                let values = 2u * params.segments + 1u;
+                var sum = result[index];
+                for (var k = begin; k < end; k = k + 1u) {
+                    sum = sum + bitcast<f32>(sparse[values + k]);
+                }
+                result[index] = sum;
             }
         }
     )";
@@ -36,13 +138,21 @@ private:
     WGPUInstance instance;
     WGPUAdapter adapter;
     WGPUDevice device;
+    WGPUQueue queue;
     WGPUShaderModule shaderModule;
     WGPUComputePipeline pipeline;
-    WGPUBuffer bufferA;
-    WGPUBuffer bufferB;
-    WGPUBuffer bufferResult;
-    WGPUBuffer stagingBuffer;
-    WGPUBindGroup bindGroup;
+    WGPUComputePipeline scatterPipeline;
+
+    std::vector<InFlightSlot> slots;
+    size_t next_slot = 0;
+    size_t in_flight = 0;
+    bool running = true;
+    std::mutex slots_mutex;
+    std::condition_variable slot_free_cv;
+    std::condition_variable work_submitted_cv;
+    std::condition_variable drained_cv;
+    std::thread poll_thread;
 
     std::string shaderEntryPoint = "main";
-};
\ No newline at end of file
+    std::string scatterEntryPoint = "scatter_add";
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+
+// Wire format shared by the backend and WebGPUTcpListener. Header fields are
+// sent in network byte order, payload values in host byte order.
+
+#define SIZE_OF_CHUNK 128
+#define MAX_DATAGRAM_SIZE 1024
+// Chunks a rank may have outstanding before the listener has granted any.
+#define INITIAL_CREDITS 1
+#define MAX_CREDITS 64
+// Chunks covered by one PAYLOAD_MANIFEST bitmap, which is as large as a
+// dense chunk.
+#define MANIFEST_CHUNKS (SIZE_OF_CHUNK * sizeof(float) * 8)
+
+enum PayloadFormat : int32_t
+{
+    PAYLOAD_DENSE = 0,
+    // Payload is `data_length` SparseEntry pairs; indices are relative to
+    // `offset` and smaller than `dense_length`.
+    PAYLOAD_SPARSE = 1,
+    // Response only: the chunk at `offset` was not admitted because the
+    // listener is out of memory and has to be sent again later.
+    PAYLOAD_BACKPRESSURE = 2,
+    // Payload is a bitmap of `dense_length` bits in `data_length` bytes,
+    // bit i set if the sender's i-th chunk of span `offset` holds a
+    // non-zero. The response carries the union over all ranks, so chunks
+    // that are zero everywhere are not sent at all.
+    PAYLOAD_MANIFEST = 3,
+};
+
+struct PacketHeader
+{
+    int32_t data_length;
+    int32_t rank;
+    int32_t world_size;
+    int32_t offset;
+    int32_t bit_width;
+    int32_t quantization_type;
+    int32_t payload_format;
+    int32_t dense_length;
+    // Sequence number of the allreduce on the sending rank. Ranks issue
+    // allreduces in the same order, so together with `offset` it names one
+    // aggregation round and keeps contributions of different allreduces
+    // apart.
+    int32_t collective;
+    // Identifies the sender's process group, agreed on by its ranks at
+    // startup, so groups sharing a listener never share a round.
+    uint32_t group;
+};
+
+// Sent by the listener in front of every aggregated chunk.
+struct ResponseHeader
+{
+    // Number of ranks that contributed to the result, lower than world_size
+    // when partial data was aggregated.
+    int32_t contributors;
+    // Offset of the chunk this result belongs to, results of different
+    // chunks may arrive out of order.
+    int32_t offset;
+    int32_t payload_format;
+    int32_t data_length;
+    int32_t dense_length;
+    // Number of chunks the rank may have outstanding from now on.
+    int32_t credits;
+    // Echoed from the request, ranks drop responses to earlier allreduces.
+    int32_t collective;
+};
+
+struct SparseEntry
+{
+    int32_t index;
+    float value;
+};
+
+static_assert(sizeof(PacketHeader) + SIZE_OF_CHUNK * sizeof(float) <= MAX_DATAGRAM_SIZE,
+    "A dense chunk must fit in a single datagram");
+static_assert(sizeof(ResponseHeader) + SIZE_OF_CHUNK * sizeof(float) <= MAX_DATAGRAM_SIZE,
+    "A dense result must fit in a single datagram");
+
+// Sparse encoding is only used when it is strictly smaller than the dense
+// one, which also guarantees it fits in a datagram.
+inline bool prefer_sparse_encoding(int32_t non_zero, int32_t dense_length)
+{
+    return non_zero * sizeof(SparseEntry) < dense_length * sizeof(float);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "webgpu_compute/webgpu_listener/webgpu_protocol.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Shared-memory transport between WebGPUTcpListener and ranks on the same
+// host. Messages use exactly the same encoding as the UDP datagrams, they are
+// just written into listener-visible memory instead of going through the
+// loopback device.
+//
+// The listener owns a control segment with a doorbell and the table of
+// attached clients. Every client (a rank of one process group) owns a
+// segment with a request ring (rank to listener) and a response ring
+// (listener to rank). Both rings are single producer, single consumer;
+// waiting is done with futexes on the ring counters and on the doorbell.
+
+#define SHM_MAGIC 0x4d485357 // "WSHM"
+#define SHM_RING_SLOTS 256
+#define SHM_MAX_CLIENTS 256
+// How long the listener waits for a rank to drain a full response ring
+// before it detaches the rank.
+#define SHM_SEND_TIMEOUT_MS 100
+
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "Shared memory rings need lock-free atomics");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory clients need lock-free atomics");
+
+struct ShmRing
+{
+    // Monotonic counters, the slot is the counter modulo SHM_RING_SLOTS.
+    std::atomic<uint32_t> head;
+    std::atomic<uint32_t> tail;
+    uint32_t lengths[SHM_RING_SLOTS];
+    char slots[SHM_RING_SLOTS][MAX_DATAGRAM_SIZE];
+};
+
+struct ShmRankSegment
+{
+    uint32_t magic;
+    uint32_t group;
+    int32_t rank;
+    ShmRing requests;
+    ShmRing responses;
+};
+
+struct ShmClient
+{
+    // Process holding the entry, 0 while free. Entries are claimed by
+    // swapping in the claimant's pid, so an entry of a process that died is
+    // taken over by the next claimant.
+    std::atomic<int32_t> pid;
+    // shm_client_id() of the rank holding the entry.
+    std::atomic<uint64_t> owner;
+    // Non-zero generation while the client's segment exists. A client that
+    // reattaches publishes a new generation so the listener remaps its
+    // segment; the listener resets it to 0 when it detaches an unresponsive
+    // client.
+    std::atomic<uint32_t> generation;
+};
+
+struct ShmControlSegment
+{
+    uint32_t magic;
+    // Bumped by ranks after every request, the listener waits on it.
+    std::atomic<uint32_t> doorbell;
+    // Unique per listener process, lets ranks notice that the listener was
+    // restarted and their mapping is of an unlinked segment.
+    uint64_t incarnation;
+    ShmClient clients[SHM_MAX_CLIENTS];
+};
+
+// Identifies a rank of a process group among the listener's clients; never 0.
+uint64_t shm_client_id(uint32_t group, int rank);
+std::string shm_control_name(int port);
+std::string shm_client_name(int port, uint64_t client_id);
+
+// RAII mapping of a POSIX shared memory object.
+class ShmRegion
+{
+public:
+    ShmRegion() = default;
+    ~ShmRegion();
+
+    ShmRegion(const ShmRegion &) = delete;
+    ShmRegion &operator=(const ShmRegion &) = delete;
+    ShmRegion(ShmRegion &&other) noexcept;
+    ShmRegion &operator=(ShmRegion &&other) noexcept;
+
+    // Creates (replacing any stale object) and zero-fills the region. The
+    // creator unlinks it on destruction.
+    static ShmRegion create(const std::string &name, size_t size);
+    // Returns an unmapped region if the object does not exist.
+    static ShmRegion open(const std::string &name, size_t size);
+
+    bool valid() const { return m_data != nullptr; }
+    template <typename T>
+    T *as() const { return static_cast<T *>(m_data); }
+
+private:
+    void reset();
+
+    std::string m_name;
+    void *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_owner = false;
+};
+
+// Return false when the ring is full or empty respectively.
+bool shm_ring_push(ShmRing &ring, const char *data, uint32_t length);
+bool shm_ring_pop(ShmRing &ring, char *data, uint32_t &length);
+
+// Sleeps while `*word == expected`, for at most `timeout_ms`.
+void shm_futex_wait(std::atomic<uint32_t> &word, uint32_t expected, int timeout_ms);
+void shm_futex_wake(std::atomic<uint32_t> &word);
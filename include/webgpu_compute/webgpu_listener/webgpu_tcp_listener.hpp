@@ -1,4 +1,8 @@
-#include "webgpu_compute.hpp"
+#pragma once
+
+#include "webgpu_compute/webgpu_compute.hpp"
+#include "webgpu_compute/webgpu_listener/webgpu_protocol.hpp"
+#include "webgpu_compute/webgpu_listener/webgpu_shm_transport.hpp"
 
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -7,71 +11,274 @@
 #include <vector>
 #include <iostream>
 #include <any>
+#include <deque>
 #include <fcntl.h>
+#include <unistd.h>
 #include <sys/select.h>
+#include <sys/mman.h>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Where the result of a contribution has to be sent.
+struct ReplyEndpoint
+{
+    sockaddr_in client_addr;
+    // Entry in ShmControlSegment::clients whose response ring receives the
+    // result, -1 for UDP.
+    int32_t shm_client = -1;
+};
 
-namespace IncComputeSimulatedSwitch
+// Names one aggregation round. Ranks of a process group issue allreduces in
+// the same order, so the group, the allreduce's sequence number and the
+// chunk's offset identify the contributions that belong together.
+struct RoundKey
 {
-    struct PacketHeader
+    uint32_t group;
+    int32_t collective;
+    int32_t offset;
+
+    bool operator==(const RoundKey &other) const
     {
-        int32_t data_length;
-        int32_t rank;
-        int32_t world_size;
-        int32_t offset;
-        int32_t bit_width;
-        int32_t quantization_type;
-    };
+        return group == other.group && collective == other.collective && offset == other.offset;
+    }
+};
 
-    class ReceivedDataContainer
+struct RoundKeyHash
+{
+    size_t operator()(const RoundKey &key) const
     {
-        std::vector<std::pair<std::vector<float>, sockaddr_in>> received_data;
+        uint64_t round = (static_cast<uint64_t>(static_cast<uint32_t>(key.collective)) << 32) |
+            static_cast<uint32_t>(key.offset);
+        return std::hash<uint64_t>()(round ^ (static_cast<uint64_t>(key.group) * 0x9e3779b97f4a7c15ULL));
+    }
+};
 
-    public:
-        void add_data(const std::vector<float> &data, const sockaddr_in &client_addr)
-        {
-            received_data.push_back({data, client_addr});
-        }
+#define CONTRIBUTION_SLOT_SIZE (SIZE_OF_CHUNK * sizeof(float))
+#define DEFAULT_MEMORY_BUDGET_MB 64
+#define DEFAULT_ROUND_TIMEOUT_MS 10000
+
+// Fixed-size memory for received chunks, allocated and committed once at
+// startup so the listener's footprint does not grow with the load.
+class ContributionSlotPool
+{
+    std::vector<char> memory;
+    std::vector<uint32_t> free_slots;
 
-        void clear()
+public:
+    explicit ContributionSlotPool(size_t budget_bytes)
+        : memory(budget_bytes / CONTRIBUTION_SLOT_SIZE * CONTRIBUTION_SLOT_SIZE)
+    {
+        uint32_t slots = static_cast<uint32_t>(memory.size() / CONTRIBUTION_SLOT_SIZE);
+        free_slots.reserve(slots);
+        for (uint32_t slot = slots; slot > 0; slot--)
         {
-            received_data.clear();
+            free_slots.push_back(slot - 1);
         }
+    }
 
-        int get_size()
+    bool acquire(uint32_t &slot)
+    {
+        if (free_slots.empty())
         {
-            return received_data.size();
+            return false;
         }
+        slot = free_slots.back();
+        free_slots.pop_back();
+        return true;
+    }
+
+    void release(uint32_t slot)
+    {
+        free_slots.push_back(slot);
+    }
+
+    char *data(uint32_t slot)
+    {
+        return memory.data() + static_cast<size_t>(slot) * CONTRIBUTION_SLOT_SIZE;
+    }
+
+    size_t capacity()
+    {
+        return memory.size() / CONTRIBUTION_SLOT_SIZE;
+    }
+
+    size_t available()
+    {
+        return free_slots.size();
+    }
+};
+
+struct ReceivedContribution
+{
+    int32_t rank;
+    int32_t payload_format;
+    // Floats or SparseEntry pairs stored in `slot`.
+    int32_t data_length;
+    uint32_t slot;
+    ReplyEndpoint reply;
+};
 
-        std::vector<std::pair<std::vector<float>, sockaddr_in>> &get_data()
+// Contributions of one aggregation round, i.e. one chunk offset of one
+// allreduce.
+class ReceivedDataContainer
+{
+    std::vector<ReceivedContribution> received_data;
+    int world_size = 0;
+    int dense_length = 0;
+    std::chrono::steady_clock::time_point opened;
+
+public:
+    void add_data(int32_t rank, int32_t payload_format, int32_t data_length, uint32_t slot,
+        const ReplyEndpoint &reply)
+    {
+        if (received_data.empty())
         {
-            return received_data;
+            opened = std::chrono::steady_clock::now();
         }
-    };
+        received_data.push_back({rank, payload_format, data_length, slot, reply});
+    }
 
-    class SimulatedSwitchServer: public TimerMixin, public RandomPacketDropMixin
+    bool has_rank(int32_t rank)
     {
-    private:
-        int sock_fd;
-        struct sockaddr_in server_addr;
-        bool handle_struggler;
-        int previous_quantization_type = -1;
-        int current_world_size = 0;
-        int current_received_size = 0;
-        int dropped_packets = 0;
+        return std::any_of(received_data.begin(), received_data.end(),
+            [rank](const ReceivedContribution &entry) { return entry.rank == rank; });
+    }
+
+    std::chrono::steady_clock::time_point get_opened()
+    {
+        return opened;
+    }
+
+    void update_shape(int round_world_size, int round_dense_length)
+    {
+        world_size = round_world_size;
+        dense_length = std::max(dense_length, round_dense_length);
+    }
+
+    void clear()
+    {
+        received_data.clear();
+        world_size = 0;
+        dense_length = 0;
+    }
+
+    int get_size()
+    {
+        return received_data.size();
+    }
+
+    int get_world_size()
+    {
+        return world_size;
+    }
+
+    int get_dense_length()
+    {
+        return dense_length;
+    }
+
+    std::vector<ReceivedContribution> &get_data()
+    {
+        return received_data;
+    }
+};
+
+// Result of a recently completed round. A UDP rank whose result datagram
+// was lost sends its chunk again and gets this copy instead of opening a
+// new round.
+struct CompletedRound
+{
+    std::chrono::steady_clock::time_point completed;
+    // Empty while the round is still being aggregated.
+    std::vector<char> packet;
+    std::vector<sockaddr_in> clients;
+};
+
+class WebGPUTcpListener
+{
+private:
+    int port;
+    int sock_fd;
+    struct sockaddr_in server_addr;
+    bool handle_struggler;
+    int previous_quantization_type = -1;
+    int dropped_packets = 0;
+
+    // Rounds in progress, so ranks can have several chunks of a bucket in
+    // flight at once. Guarded by
+    // rounds_mutex since UDP and shared-memory messages are received on
+    // different threads.
+    std::unordered_map<RoundKey, ReceivedDataContainer, RoundKeyHash> rounds;
+    std::mutex rounds_mutex;
+
+    // Rounds still missing contributions after this long are evicted, so a
+    // rank that died mid-allreduce cannot hold memory forever.
+    std::chrono::milliseconds round_timeout;
+    std::chrono::steady_clock::time_point last_expiry_scan;
+
+    // Admission control: a new round is only opened when the slots still
+    // missing from every open round stay covered, so open rounds can always
+    // complete. Both guarded by rounds_mutex.
+    ContributionSlotPool slot_pool;
+    size_t reserved_slots = 0;
+
+    // Kept for round_timeout whatever their number: a rank resends a chunk
+    // until it is answered or times out, and a bucket has far more chunks
+    // than any count cap would hold.
+    // Filled in from the compute poll thread, so it has its own mutex,
+    // which is never held while taking rounds_mutex.
+    std::unordered_map<RoundKey, CompletedRound, RoundKeyHash> completed_rounds;
+    std::deque<std::pair<RoundKey, std::chrono::steady_clock::time_point>> completed_order;
+    std::mutex completed_mutex;
+
+    // Shared-memory transport for colocated ranks, see webgpu_shm_transport.hpp.
+    ShmRegion shm_control;
+    // Per entry of ShmControlSegment::clients: the mapped segment and the
+    // owner and generation it was mapped for.
+    std::vector<ShmRegion> shm_clients;
+    std::vector<uint64_t> shm_owners;
+    std::vector<uint32_t> shm_generations;
+    std::mutex shm_mutex;
+    std::atomic<bool> shm_running{false};
+    std::thread shm_thread;
 
-        ReceivedDataContainer received_data_unquantized;
+    ReceivedDataContainer &store(const RoundKey &key);
 
-        ReceivedDataContainer &store();
+    // Drained by the destructor before the socket and shared-memory
+    // segments pending results are sent to are closed.
+    WebGPUCompute webgpu_compute;
 
-        WebGPUCompute webgpu_compute;
+    void handle_message(char *buffer, size_t bytes_received, const ReplyEndpoint &reply);
+    void handle_shm();
+    void send_result(const ReplyEndpoint &reply, const std::vector<char> &packet);
+    bool admit_round(int world_size);
+    int32_t credits(int world_size);
+    void send_backpressure(const ReplyEndpoint &reply, int32_t collective, int32_t offset,
+        int32_t dense_length, int32_t granted);
+    void expire_rounds();
+    // `packet` is empty while the round is still being aggregated.
+    void remember_completed(const RoundKey &key, const std::vector<ReplyEndpoint> &clients,
+        const std::vector<char> &packet);
+    bool find_completed(const RoundKey &key, const ReplyEndpoint &reply, std::vector<char> &packet);
 
-    public:
-        SimulatedSwitchServer(int port, bool handle_struggler = false);
+public:
+    WebGPUTcpListener(int port, bool enable_shm = true,
+        size_t memory_budget_bytes = DEFAULT_MEMORY_BUDGET_MB * 1024 * 1024,
+        std::chrono::milliseconds round_timeout = std::chrono::milliseconds(DEFAULT_ROUND_TIMEOUT_MS));
+    ~WebGPUTcpListener();
 
-        void handle_packet();
-        std::vector<float> aggregate_data(const std::vector<std::pair<std::vector<float>, sockaddr_in>> &data);
-        void run();
-        void reset();
-    };
-} // namespace IncComputeSimulatedSwitch
\ No newline at end of file
+    void handle_packet();
+    void process_data(PacketHeader *header, const char *payload, const ReplyEndpoint &reply);
+    void aggregate_data(const RoundKey &key, ReceivedDataContainer &round);
+    // ORs the PAYLOAD_MANIFEST bitmaps of a complete round and returns the
+    // response for `clients`.
+    std::vector<char> merge_manifests(const RoundKey &key, ReceivedDataContainer &round,
+        std::vector<ReplyEndpoint> &clients);
+    void run();
+    void reset(const RoundKey &key);
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <webgpu_compute/webgpu_listener/webgpu_protocol.hpp>
+#include <webgpu_compute/webgpu_listener/webgpu_shm_transport.hpp>
+
+#include <netinet/in.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Points every listener gets on the consistent hashing ring.
+#define LISTENER_VIRTUAL_NODES 256
+// Over UDP an unanswered chunk is sent again after this long, doubling up
+// to CHUNK_RESEND_MAX_MS.
+#define CHUNK_RESEND_INITIAL_MS 20
+#define CHUNK_RESEND_MAX_MS 1000
+
+namespace c10d
+{
+
+    enum class ListenerTransport
+    {
+        // Shared memory when the listener runs on this host and exposes it,
+        // UDP otherwise.
+        AUTO,
+        UDP,
+        SHM,
+    };
+
+    ListenerTransport parse_listener_transport(const std::string &name);
+
+    struct ListenerEndpoint
+    {
+        std::string host;
+        int port;
+    };
+
+    // Parses a comma separated "host:port" list.
+    std::vector<ListenerEndpoint> parse_listener_endpoints(const std::string &endpoints);
+    std::string format_listener_endpoints(const std::vector<ListenerEndpoint> &endpoints);
+    // Replaces the host with its dotted IPv4 address, so that a name and an
+    // address of the same listener compare and hash alike.
+    ListenerEndpoint resolve_listener_endpoint(const ListenerEndpoint &endpoint);
+
+    // Rank-side endpoint of the WebGPUTcpListener protocol. Payloads are split
+    // into SIZE_OF_CHUNK sized chunks; every chunk is one aggregation round on
+    // the listener and is sent either dense or as (index, value) pairs,
+    // whichever is smaller. The number of chunks in flight is paced by the
+    // credits the listener grants with every response; chunks it turns away
+    // for lack of memory are sent again after a backoff, and chunks left
+    // unanswered over UDP are sent again when their resend timer runs out.
+    //
+    // `group` identifies the process group on a listener shared by several
+    // jobs or groups; every rank of the group has to pass the same value.
+    class WebGPUListenerClient
+    {
+    public:
+        WebGPUListenerClient(const std::string &host, int port, int rank, int world_size,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(30000),
+            ListenerTransport transport = ListenerTransport::AUTO, uint32_t group = 0);
+        ~WebGPUListenerClient();
+
+        WebGPUListenerClient(const WebGPUListenerClient &) = delete;
+        WebGPUListenerClient &operator=(const WebGPUListenerClient &) = delete;
+
+        // Replaces `data` with the sum over all ranks. With
+        // `skip_zero_chunks`, which every rank has to pass alike, ranks
+        // first exchange PAYLOAD_MANIFEST bitmaps of the chunks they hold
+        // non-zeros in, and chunks that are zero on every rank are not sent.
+        void allreduce(std::vector<float> &data, bool skip_zero_chunks = false);
+        // Same for the SIZE_OF_CHUNK sized chunks of `data` listed in
+        // `chunks`, in ascending order, only; the rest of `data` is left
+        // untouched.
+        void allreduce(std::vector<float> &data, const std::vector<size_t> &chunks,
+            bool skip_zero_chunks = false);
+
+        bool uses_shm() const { return m_shm_segment.valid(); }
+        size_t bytes_sent() const { return m_bytes_sent; }
+        size_t bytes_received() const { return m_bytes_received; }
+        int32_t credits() const { return m_credits; }
+        size_t backpressure_events() const { return m_backpressure_events; }
+        size_t resent_chunks() const { return m_resent_chunks; }
+        size_t skipped_chunks() const { return m_skipped_chunks; }
+
+    private:
+        bool attach_shm(int port);
+        // Called when a shared-memory exchange timed out. If the listener
+        // restarted or detached this rank, reattaches to the current
+        // listener, or falls back to UDP when it exposes no shared memory.
+        void recover_shm();
+
+        // Transport primitives shared by UDP and shared memory. Over UDP
+        // receive returns 0 if nothing arrived by `deadline`.
+        bool transmit(const char *buffer, size_t size);
+        void flush();
+        size_t receive(char *buffer, std::chrono::steady_clock::time_point deadline);
+
+        enum class ChunkResult
+        {
+            COMPLETED,
+            // Turned away for lack of memory, or its round was evicted.
+            REJECTED,
+            // Belongs to an earlier allreduce that failed on this rank.
+            STALE,
+        };
+
+        // Runs one collective in which every item is one request answered
+        // by one response: `encode` writes the request for an item and
+        // `decode` handles a response and names the item it answers.
+        void exchange(size_t items,
+            const std::function<size_t(size_t item, char *buffer)> &encode,
+            const std::function<ChunkResult(const char *buffer, size_t size, size_t &item)> &decode);
+        void exchange_chunks(std::vector<float> &data, const std::vector<size_t> &chunks);
+        // Returns the union bitmap over all ranks, bit i for chunks[i].
+        std::vector<uint8_t> exchange_manifests(const std::vector<float> &data, const std::vector<size_t> &chunks);
+
+        size_t encode_chunk(char *buffer, const float *chunk, int32_t length, int32_t offset);
+        // Writes a result into `data` and stores the chunk offset in `offset`.
+        ChunkResult decode_result(const char *buffer, size_t size, std::vector<float> &data, int32_t &offset);
+        // Bitmap of the MANIFEST_CHUNKS chunks of `chunks` starting at
+        // span * MANIFEST_CHUNKS.
+        size_t encode_manifest(char *buffer, const std::vector<float> &data, const std::vector<size_t> &chunks, size_t span);
+        ChunkResult decode_manifest(const char *buffer, size_t size, std::vector<uint8_t> &present, size_t &span);
+
+        int sock_fd;
+        struct sockaddr_in server_addr;
+        int m_rank;
+        int m_world_size;
+        std::chrono::milliseconds m_timeout;
+        uint32_t m_group;
+
+        int m_port;
+        ShmRegion m_shm_control;
+        ShmRegion m_shm_segment;
+        // Entry of ShmControlSegment::clients held while attached.
+        int m_shm_client = -1;
+        uint32_t m_shm_generation = 0;
+
+        size_t m_bytes_sent = 0;
+        size_t m_bytes_received = 0;
+        int32_t m_credits = INITIAL_CREDITS;
+        // Sequence number of the current allreduce, see PacketHeader.
+        int32_t m_collective = 0;
+        size_t m_backpressure_events = 0;
+        size_t m_resent_chunks = 0;
+        size_t m_skipped_chunks = 0;
+    };
+
+    // Thread that runs the work of one listener shard for the lifetime of a
+    // ShardedListenerClient, so collectives do not start threads.
+    class ShardWorker
+    {
+    public:
+        ShardWorker();
+        ~ShardWorker();
+
+        ShardWorker(const ShardWorker &) = delete;
+        ShardWorker &operator=(const ShardWorker &) = delete;
+
+        // Runs `task` on the worker; the future rethrows what it threw.
+        std::future<void> submit(std::function<void()> task);
+
+    private:
+        void run();
+
+        std::mutex m_mutex;
+        std::condition_variable m_ready;
+        std::deque<std::packaged_task<void()>> m_tasks;
+        bool m_stopping = false;
+        std::thread m_thread;
+    };
+
+    // Spreads the chunks of every payload over several listeners so that
+    // their bandwidth and reducers add up. Chunks are assigned with
+    // consistent hashing on the chunk index: every rank computes the same
+    // assignment from the same endpoint set, whatever order it is listed in
+    // and whether it names listeners by hostname or address, and adding or
+    // removing a listener only moves the chunks of that one.
+    class ShardedListenerClient
+    {
+    public:
+        ShardedListenerClient(const std::vector<ListenerEndpoint> &endpoints, int rank, int world_size,
+            std::chrono::milliseconds timeout = std::chrono::milliseconds(30000),
+            ListenerTransport transport = ListenerTransport::AUTO, uint32_t group = 0);
+
+        // Replaces `data` with the sum over all ranks, exchanging the chunks
+        // of every listener in parallel. See WebGPUListenerClient::allreduce
+        // for `skip_zero_chunks`.
+        void allreduce(std::vector<float> &data, bool skip_zero_chunks = false);
+
+        // Index into endpoints() of the listener aggregating `chunk`.
+        size_t shard_of(size_t chunk) const;
+
+        // Resolved endpoints, in the order they were given.
+        const std::vector<ListenerEndpoint> &endpoints() const { return m_endpoints; }
+        // Resolved endpoints in sorted order; ranks with equal sets assign
+        // chunks alike.
+        std::string endpoint_set() const;
+        WebGPUListenerClient &shard(size_t index) { return *m_shards[index]; }
+        size_t shard_count() const { return m_shards.size(); }
+        size_t bytes_sent() const;
+        size_t bytes_received() const;
+
+    private:
+        std::vector<ListenerEndpoint> m_endpoints;
+        std::vector<std::unique_ptr<WebGPUListenerClient>> m_shards;
+        // Sorted (hash, shard) points of every listener on the ring.
+        std::vector<std::pair<uint64_t, size_t>> m_ring;
+        // One per shard but the first, which the calling thread serves.
+        // Declared last so they are stopped before the shards go away.
+        std::vector<std::unique_ptr<ShardWorker>> m_workers;
+    };
+}
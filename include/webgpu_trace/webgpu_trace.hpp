@@ -0,0 +1,96 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Compact binary trace of the collectives issued by one rank. The format is
+// independent of torch so it can be replayed by a standalone tool:
+//
+//   TraceFileHeader
+//   repeated { TraceRecordHeader, TraceTensor[num_tensors] }
+//
+// All integers are written in host byte order.
+
+#define TRACE_MAGIC 0x52544757 // "WGTR"
+#define TRACE_VERSION 2
+// c10d::OpType::ALLREDUCE and c10::ScalarType::Float, for tools that do
+// not link torch.
+#define TRACE_OP_ALLREDUCE 1
+#define TRACE_DTYPE_FLOAT32 6
+
+#pragma pack(push, 1)
+struct TraceFileHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t rank;
+    int32_t world_size;
+};
+
+struct TraceRecordHeader
+{
+    // c10d::OpType of the collective.
+    uint8_t op;
+    uint32_t num_tensors;
+    int32_t rank;
+    // Relative to the first record of the trace.
+    uint64_t start_ns;
+    uint64_t duration_ns;
+    // Idle time between the end of the previous collective and this one.
+    uint64_t gap_ns;
+};
+
+struct TraceTensor
+{
+    uint64_t numel;
+    // c10::ScalarType of the tensor.
+    int8_t dtype;
+};
+#pragma pack(pop)
+
+struct TraceRecord
+{
+    TraceRecordHeader header;
+    std::vector<TraceTensor> tensors;
+
+    uint64_t total_numel() const;
+};
+
+class CollectiveTraceRecorder
+{
+public:
+    CollectiveTraceRecorder(const std::string &path, int rank, int world_size);
+    ~CollectiveTraceRecorder();
+
+    // `start` and `end` bracket the collective as seen by the caller.
+    void record(uint8_t op, const std::vector<TraceTensor> &tensors,
+        std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end);
+
+    void flush();
+
+private:
+    std::mutex m_mutex;
+    std::ofstream m_file;
+    int m_rank;
+    bool m_started = false;
+    std::chrono::steady_clock::time_point m_origin;
+    std::chrono::steady_clock::time_point m_previous_end;
+};
+
+class CollectiveTraceReader
+{
+public:
+    explicit CollectiveTraceReader(const std::string &path);
+
+    const TraceFileHeader &header() const { return m_header; }
+    const std::vector<TraceRecord> &records() const { return m_records; }
+
+private:
+    TraceFileHeader m_header;
+    std::vector<TraceRecord> m_records;
+};
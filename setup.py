@@ -46,7 +46,12 @@ else:
 
 vcpkg_installed = "vcpkg_installed"
 
-sources = ["src/webgpu_backend.cpp"]
+sources = [
+    "src/webgpu_backend.cpp",
+    "src/webgpu_listener_client.cpp",
+    "src/webgpu_compute/webgpu_listener/webgpu_shm_transport.cpp",
+    "src/webgpu_trace/webgpu_trace.cpp",
+]
 
 # Combine include directories from both CMake and original paths
 include_dirs = [
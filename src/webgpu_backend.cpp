@@ -1,6 +1,20 @@
 #include "webgpu_backend.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <stdexcept>
+#include <string>
+
 #define SERVER_PORT 30000
+#define SERVER_HOST "127.0.0.1"
+// Store key rank 0 publishes the listener endpoints under.
+#define LISTENER_ENDPOINTS_STORE_KEY "webgpu_listener_endpoints"
+// Store key rank 0 publishes the group's listener id under. Every process
+// group gets its own prefixed store, so the key never collides.
+#define LISTENER_GROUP_STORE_KEY "webgpu_listener_group"
 
 namespace c10d
 {
@@ -47,25 +61,245 @@ namespace c10d
     }
   }
 
-  at::Tensor pinnedLike(at::Tensor& tensor) {
-    auto* allocator = at::detail::getCUDAHooks().getPinnedMemoryAllocator();
-    auto storage = c10::Storage(
-        c10::Storage::use_byte_size_t(),
-        static_cast<int64_t>(at::detail::computeStorageNbytes(
-            tensor.sizes(), tensor.strides(), tensor.dtype().itemsize())),
-        allocator,
-        /*resizable=*/false);
-    return at::empty({0}, tensor.options().device(at::kCPU))
-        .set_(storage, 0, tensor.sizes(), tensor.strides());
+  size_t alignStaging(size_t bytes) {
+    return (bytes + STAGING_ALIGNMENT - 1) / STAGING_ALIGNMENT * STAGING_ALIGNMENT;
+  }
+
+  PinnedStagingPool::PinnedStagingPool(size_t capacity_bytes)
+      : m_capacity(capacity_bytes) {}
+
+  bool PinnedStagingPool::is_idle(const Block &block) {
+    for (const auto &event : block.pending) {
+      if (!event.query()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::unique_ptr<PinnedStagingPool::Block> PinnedStagingPool::acquire(size_t bytes) {
+    size_t size_class = STAGING_MIN_SIZE_CLASS;
+    while (size_class < bytes) {
+      size_class *= 2;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto &free_blocks = m_free[size_class];
+    for (auto it = free_blocks.begin(); it != free_blocks.end(); ++it) {
+      if (is_idle(**it)) {
+        auto block = std::move(*it);
+        free_blocks.erase(it);
+        block->pending.clear();
+        return block;
+      }
+    }
+
+    if (m_pinned_bytes + size_class > m_capacity) {
+      evict_idle_blocks(m_pinned_bytes + size_class - m_capacity);
+    }
+
+    auto block = std::make_unique<Block>();
+    block->size_class = size_class;
+    void *data = nullptr;
+    bool pinned = m_pinned_bytes + size_class <= m_capacity;
+    if (pinned && cudaHostAlloc(&data, size_class, cudaHostAllocDefault) != cudaSuccess) {
+      // Out of page-locked memory; clear the error and stage pageable.
+      cudaGetLastError();
+      pinned = false;
+    }
+    if (pinned) {
+      auto *allocation = new PinnedAllocation{this, size_class, data};
+      block->storage = c10::Storage(
+          c10::Storage::use_byte_size_t(),
+          static_cast<int64_t>(size_class),
+          c10::DataPtr(data, allocation, &PinnedStagingPool::free_pinned, c10::Device(c10::DeviceType::CPU)),
+          /*allocator=*/nullptr,
+          /*resizable=*/false);
+      block->pinned = true;
+      m_pinned_bytes += size_class;
+      m_pinned_allocations++;
+    } else {
+      block->storage = c10::Storage(
+          c10::Storage::use_byte_size_t(),
+          static_cast<int64_t>(size_class),
+          c10::GetCPUAllocator(),
+          /*resizable=*/false);
+      block->pinned = false;
+      m_pageable_fallbacks++;
+    }
+    return block;
+  }
+
+  void PinnedStagingPool::release(std::unique_ptr<Block> block, const std::vector<c10::Stream> &streams) {
+    if (!block || !block->pinned) {
+      return;
+    }
+
+    for (const auto &stream : streams) {
+      block->pending.emplace_back(stream.device_type());
+      block->pending.back().record(stream);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_free[block->size_class].push_back(std::move(block));
+  }
+
+  void PinnedStagingPool::evict_idle_blocks(size_t bytes_needed) {
+    size_t freed = 0;
+    // Largest classes first, so as few blocks as possible are dropped.
+    for (auto it = m_free.rbegin(); it != m_free.rend() && freed < bytes_needed; ++it) {
+      auto &blocks = it->second;
+      for (auto block = blocks.begin(); block != blocks.end() && freed < bytes_needed;) {
+        if (is_idle(**block)) {
+          freed += (*block)->size_class;
+          block = blocks.erase(block);
+        } else {
+          ++block;
+        }
+      }
+    }
+  }
+
+  void PinnedStagingPool::free_pinned(void *context) {
+    auto *allocation = static_cast<PinnedAllocation *>(context);
+    cudaFreeHost(allocation->data);
+    allocation->pool->m_pinned_bytes -= allocation->bytes;
+    delete allocation;
+  }
+
+  size_t PinnedStagingPool::pinned_allocations() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pinned_allocations;
+  }
+
+  size_t PinnedStagingPool::pinned_bytes() {
+    return m_pinned_bytes;
+  }
+
+  size_t PinnedStagingPool::pageable_fallbacks() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_pageable_fallbacks;
   }
 #endif
 
+  void TopKSparsifier::set_ratio(float ratio) {
+    if (ratio < 0.0f || ratio >= 1.0f) {
+      throw std::invalid_argument("topk_ratio must be in [0, 1)");
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ratio = ratio;
+    m_residuals.clear();
+  }
+
+  float TopKSparsifier::ratio() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_ratio;
+  }
+
+  void TopKSparsifier::make_room() {
+    for (auto it = m_residuals.begin(); it != m_residuals.end();) {
+      it = it->second.buffer.expired() ? m_residuals.erase(it) : std::next(it);
+    }
+    while (m_residuals.size() >= TOPK_MAX_RESIDUALS) {
+      auto oldest = std::min_element(m_residuals.begin(), m_residuals.end(),
+          [](const auto &a, const auto &b) { return a.second.last_use < b.second.last_use; });
+      m_residuals.erase(oldest);
+    }
+  }
+
+  void TopKSparsifier::sparsify(int64_t bucket, const at::Tensor &buffer, std::vector<float> &data) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_ratio <= 0.0f || data.empty()) {
+      return;
+    }
+
+    if (m_residuals.find(bucket) == m_residuals.end()) {
+      make_room();
+    }
+    auto &entry = m_residuals[bucket];
+    // A rebuilt or reallocated bucket starts without error feedback.
+    if (entry.buffer.expired() || entry.buffer._unsafe_get_target() != buffer.unsafeGetTensorImpl() ||
+        entry.values.size() != data.size()) {
+      entry.buffer = c10::weak_intrusive_ptr<c10::TensorImpl, c10::UndefinedTensorImpl>(buffer.getIntrusivePtr());
+      entry.values.assign(data.size(), 0.0f);
+    }
+    entry.last_use = ++m_calls;
+    auto &residual = entry.values;
+
+    std::vector<float> magnitudes(data.size());
+    for (size_t i = 0; i < data.size(); i++) {
+      data[i] += residual[i];
+      magnitudes[i] = std::fabs(data[i]);
+    }
+
+    size_t k = std::max<size_t>(1, static_cast<size_t>(std::ceil(m_ratio * data.size())));
+    std::nth_element(magnitudes.begin(), magnitudes.begin() + (data.size() - k), magnitudes.end());
+    float threshold = magnitudes[data.size() - k];
+
+    // Ties at the threshold are kept in index order until k entries are sent.
+    size_t kept = 0;
+    for (size_t i = 0; i < data.size(); i++) {
+      if (kept < k && std::fabs(data[i]) >= threshold) {
+        residual[i] = 0.0f;
+        kept++;
+      } else {
+        residual[i] = data[i];
+        data[i] = 0.0f;
+      }
+    }
+  }
+
+  AllreduceAlgorithm AllreduceAlgorithmSelector::select(size_t bytes, int world_size) {
+    size_t crossover = DEFAULT_GLOO_CROSSOVER_BYTES;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_crossover.upper_bound(world_size);
+      if (it != m_crossover.begin()) {
+        crossover = std::prev(it)->second;
+      }
+    }
+
+    return bytes < crossover ? AllreduceAlgorithm::GLOO : AllreduceAlgorithm::LISTENER;
+  }
+
+  void AllreduceAlgorithmSelector::count(AllreduceAlgorithm algorithm, size_t bytes) {
+    m_calls[static_cast<int>(algorithm)]++;
+    m_bytes[static_cast<int>(algorithm)] += bytes;
+  }
+
+  void AllreduceAlgorithmSelector::set_crossover(int world_size, size_t bytes) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_crossover[world_size] = bytes;
+  }
+
+  void AllreduceAlgorithmSelector::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_crossover.clear();
+  }
+
+  std::map<int, size_t> AllreduceAlgorithmSelector::crossover_table() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_crossover;
+  }
+
+  size_t AllreduceAlgorithmSelector::calls(AllreduceAlgorithm algorithm) const {
+    return m_calls[static_cast<int>(algorithm)];
+  }
+
+  size_t AllreduceAlgorithmSelector::bytes(AllreduceAlgorithm algorithm) const {
+    return m_bytes[static_cast<int>(algorithm)];
+  }
+
   WebGPUBackendWork::WebGPUBackendWork(OpType opType, std::vector<at::Tensor> &tensors, 
-    int rank, int world_size, c10::intrusive_ptr<c10::ivalue::Future> future)
+    int rank, int world_size, WebGPUBackend *backend,
+    c10::intrusive_ptr<c10::ivalue::Future> future, int64_t sparsify_bucket)
       : Work(-1, opType),
         tensors_(tensors),
         m_rank(rank),
         m_world_size(world_size),
+        m_backend(backend),
+        m_sparsify_bucket(sparsify_bucket),
         future_(future)
   {
     this->host_tensors_.reserve(this->tensors_.size());
@@ -73,15 +307,43 @@ namespace c10d
     if (this->tensors_[0].is_cuda()) {
         initializeStreamsEvents(this->tensors_, this->streams_, this->events_);
 
-        at::cuda::OptionalCUDAStreamGuard guard;
-        guard.reset_stream(this->streams_[0]);
-        this->host_tensors_.push_back(pinnedLike(this->tensors_[0]).copy_(this->tensors_[0], /*non_blocking=*/ true));
+        // Stage every dense tensor into one contiguous pinned region taken
+        // from the backend's pool, one async copy per tensor on its side stream.
+        size_t staging_bytes = 0;
+        for (const auto &tensor : this->tensors_) {
+          if (!tensor.is_sparse()) {
+            staging_bytes += alignStaging(tensor.numel() * tensor.element_size());
+          }
+        }
+        // All-sparse lists are copied without staging.
+        if (staging_bytes > 0) {
+          this->staging_block_ = this->m_backend->staging_pool().acquire(staging_bytes);
+        }
+
+        c10::OptionalStreamGuard guard;
+        size_t staging_offset = 0;
+        for (const auto i : c10::irange(this->tensors_.size())) {
+          auto &tensor = this->tensors_[i];
+          guard.reset_stream(this->streams_[i]);
+          if (tensor.is_sparse()) {
+            this->host_tensors_.push_back(tensor.to(at::kCPU));
+            continue;
+          }
+
+          auto host = at::empty({0}, tensor.options().device(at::kCPU))
+              .set_(this->staging_block_->storage,
+                  static_cast<int64_t>(staging_offset / tensor.element_size()),
+                  tensor.sizes());
+          host.copy_(tensor, /*non_blocking=*/ true);
+          this->host_tensors_.push_back(host);
+          staging_offset += alignStaging(tensor.numel() * tensor.element_size());
+        }
         this->on_cuda_ = true;
     } else {
         this->on_cuda_ = false;
 
-        for (const auto i : c10::irange(this->tensors_.size())) {
-          this->host_tensors_[i].copy_(this->tensors_[i], false);
+        for (const auto& tensor : this->tensors_) {
+          this->host_tensors_.push_back(tensor.clone());
         }
     }
 #else
@@ -156,10 +418,42 @@ namespace c10d
     // Allocate buffer for combined data
     std::vector<float> combined_data(total_elements);
     size_t offset = 0;
+    // Sparse payloads leave most chunks zero on every rank, which the
+    // listener client then skips instead of sending.
+    bool skip_zero_chunks = this->m_sparsify_bucket >= 0;
 
     // Copy all tensor data to combined buffer
     for (auto &tensor : this->host_tensors_)
     {
+      if (tensor.is_sparse())
+      {
+        // Scattered straight into the zeroed buffer rather than densified.
+        auto coalesced = tensor.coalesce();
+        auto indices = coalesced._indices().contiguous();
+        auto values = coalesced._values().contiguous().to(torch::kFloat32);
+        int64_t sparse_dim = coalesced.sparse_dim();
+        int64_t row = 1;
+        for (int64_t d = sparse_dim; d < coalesced.dim(); d++)
+        {
+          row *= coalesced.size(d);
+        }
+
+        auto index = indices.accessor<int64_t, 2>();
+        const float *value = values.data_ptr<float>();
+        for (int64_t k = 0; k < coalesced._nnz(); k++)
+        {
+          int64_t linear = 0;
+          for (int64_t d = 0; d < sparse_dim; d++)
+          {
+            linear = linear * coalesced.size(d) + index[d][k];
+          }
+          memcpy(combined_data.data() + offset + linear * row, value + k * row, row * sizeof(float));
+        }
+        offset += tensor.numel();
+        skip_zero_chunks = true;
+        continue;
+      }
+
       auto t = tensor;
       if (!t.is_contiguous())
       {
@@ -177,8 +471,15 @@ namespace c10d
       offset += numel;
     }
 
+    // Drop all but the top-k entries of buckets that opted in. Chunks that
+    // end up mostly zero are sent as (index, value) pairs by the listener
+    // client.
+    if (this->m_sparsify_bucket >= 0) {
+      this->m_backend->sparsifier().sparsify(this->m_sparsify_bucket, this->tensors_[0], combined_data);
+    }
+
     // 1. Send tensors to webgpu for reduction
-    WebGPUCompute::perform_aggregation(combined_data, this->m_rank, this->m_world_size);
+    this->m_backend->listener_client().allreduce(combined_data, skip_zero_chunks);
 
     // Spread the combined data back to individual tensors
     offset = 0;
@@ -187,9 +488,16 @@ namespace c10d
     {
       auto &tensor = this->host_tensors_[i];
       auto numel = tensor_sizes[i];
-      memcpy(tensor.data_ptr<float>(),
-         combined_data.data() + offset,
-         numel * sizeof(float));
+      auto reduced = torch::from_blob(combined_data.data() + offset,
+         tensor.sizes(), torch::kFloat32);
+      if (tensor.is_sparse())
+      {
+        tensor = reduced.to_sparse(tensor.sparse_dim());
+      }
+      else
+      {
+        tensor.copy_(reduced);
+      }
       offset += numel;
     }
 
@@ -204,6 +512,10 @@ namespace c10d
         events_[i].record(streams_[i]);
       }
 
+      // The region is reused only after the copies queued above complete.
+      this->host_tensors_.clear();
+      this->m_backend->staging_pool().release(std::move(this->staging_block_), this->streams_);
+
       // this->synchronize();
     } else {
       // Copy the data back to the original tensors in the CPU.
@@ -219,7 +531,7 @@ namespace c10d
 #endif
   }
 
-  void IncBackendWork::synchronize() {
+  void WebGPUBackendWork::synchronize() {
 #ifdef IS_CUDA_BUILD
     if (!this->on_cuda_) {
       return;
@@ -233,6 +545,21 @@ namespace c10d
 #endif
   }
 
+  // Random id that keeps the rounds and shared-memory segments of this
+  // process group apart from those of other groups and jobs using the same
+  // listeners.
+  static uint32_t agree_on_listener_group(const c10::intrusive_ptr<::c10d::Store> &store, int rank)
+  {
+    if (rank == 0)
+    {
+      std::random_device random;
+      std::string group = std::to_string(static_cast<uint32_t>(random()));
+      store->set(LISTENER_GROUP_STORE_KEY, std::vector<uint8_t>(group.begin(), group.end()));
+    }
+    std::vector<uint8_t> group = store->get(LISTENER_GROUP_STORE_KEY);
+    return static_cast<uint32_t>(std::stoul(std::string(group.begin(), group.end())));
+  }
+
   WebGPUBackend::WebGPUBackend(const c10::intrusive_ptr<::c10d::Store> &store,
             int rank,
             int size,
@@ -241,13 +568,270 @@ namespace c10d
       : ProcessGroupGloo(store, rank, size, options),
         m_rank(rank),
         m_world_size(size)
+#ifdef IS_CUDA_BUILD
+        , m_staging_pool(static_cast<size_t>(std::getenv("WEBGPU_PINNED_POOL_MB")
+            ? std::stoul(std::getenv("WEBGPU_PINNED_POOL_MB"))
+            : STAGING_DEFAULT_CAPACITY_MB) * 1024 * 1024)
+#endif
   {
-    g_current_inc_backend = this;
+    const char *host = std::getenv("WEBGPU_LISTENER_HOST");
+    const char *port = std::getenv("WEBGPU_LISTENER_PORT");
+    const char *endpoints = std::getenv("WEBGPU_LISTENER_ENDPOINTS");
+    const char *transport = std::getenv("WEBGPU_LISTENER_TRANSPORT");
+
+    bool from_store = endpoints && std::string(endpoints) == "store";
+    std::vector<ListenerEndpoint> listeners;
+    if (from_store)
+    {
+      // Blocks until rank 0 or the launcher has published the endpoints.
+      std::vector<uint8_t> published = store->get(LISTENER_ENDPOINTS_STORE_KEY);
+      listeners = parse_listener_endpoints(std::string(published.begin(), published.end()));
+    }
+    else
+    {
+      listeners = endpoints ? parse_listener_endpoints(endpoints)
+          : std::vector<ListenerEndpoint>{{host ? host : SERVER_HOST, port ? std::stoi(port) : SERVER_PORT}};
+    }
+
+    m_listener_client = std::make_unique<ShardedListenerClient>(
+        listeners,
+        rank, size,
+        std::chrono::duration_cast<std::chrono::milliseconds>(timeout),
+        parse_listener_transport(transport ? transport : ""),
+        agree_on_listener_group(store, rank));
+
+    if (!from_store)
+    {
+      // Chunks are assigned to listeners by their resolved endpoints, so a
+      // rank that resolves a different set would send chunks to listeners
+      // the other ranks never use and wait forever. Rank 0 publishes its
+      // resolved set and the others check theirs against it.
+      std::string resolved = m_listener_client->endpoint_set();
+      if (rank == 0)
+      {
+        store->set(LISTENER_ENDPOINTS_STORE_KEY, std::vector<uint8_t>(resolved.begin(), resolved.end()));
+      }
+      else
+      {
+        std::vector<uint8_t> published = store->get(LISTENER_ENDPOINTS_STORE_KEY);
+        if (std::string(published.begin(), published.end()) != resolved)
+        {
+          throw std::invalid_argument("Listener endpoints of rank " + std::to_string(rank) + " resolve to " +
+              resolved + " but those of rank 0 to " + std::string(published.begin(), published.end()));
+        }
+      }
+    }
+
+    g_current_webgpu_backend = this;
   }
 
   c10::intrusive_ptr<Work> WebGPUBackend::allreduce(
     std::vector<at::Tensor> &tensors,
     const AllreduceOptions &opts)
+  {
+    size_t bytes = 0;
+    for (const auto &tensor : tensors) {
+      bytes += tensor.numel() * tensor.element_size();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    c10::intrusive_ptr<Work> work;
+    // The listener can only add, so every other reduction goes to Gloo
+    // whatever its size. For sums, Gloo only handles a single dense tensor
+    // per call here; everything else keeps going through the listener.
+    bool gloo_capable = tensors.size() == 1 && !tensors[0].is_sparse();
+    auto algorithm = opts.reduceOp != ReduceOp::SUM ? AllreduceAlgorithm::GLOO
+        : gloo_capable ? this->m_algorithm_selector.select(bytes, this->m_world_size)
+        : AllreduceAlgorithm::LISTENER;
+    this->m_algorithm_selector.count(algorithm, bytes);
+    if (algorithm == AllreduceAlgorithm::GLOO) {
+      work = ProcessGroupGloo::allreduce(tensors, opts);
+      this->record_collective(OpType::ALLREDUCE, tensors, start, work);
+    } else {
+      // The listener path has completed by the time the work is returned.
+      work = this->allreduce_listener(tensors);
+      this->record_collective(OpType::ALLREDUCE, tensors, start);
+    }
+
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::broadcast(
+    std::vector<at::Tensor> &tensors,
+    const BroadcastOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::broadcast(tensors, opts);
+    this->record_collective(OpType::BROADCAST, tensors, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::reduce(
+    std::vector<at::Tensor> &tensors,
+    const ReduceOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::reduce(tensors, opts);
+    this->record_collective(OpType::REDUCE, tensors, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::allgather(
+    std::vector<std::vector<at::Tensor>> &outputs,
+    std::vector<at::Tensor> &inputs,
+    const AllgatherOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::allgather(outputs, inputs, opts);
+    this->record_collective(OpType::ALLGATHER, inputs, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::reduce_scatter(
+    std::vector<at::Tensor> &outputs,
+    std::vector<std::vector<at::Tensor>> &inputs,
+    const ReduceScatterOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::reduce_scatter(outputs, inputs, opts);
+    this->record_collective(OpType::REDUCE_SCATTER, inputs.empty() ? outputs : inputs[0], start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::barrier(const BarrierOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::barrier(opts);
+    this->record_collective(OpType::BARRIER, {}, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::allreduce_coalesced(
+    std::vector<at::Tensor> &tensors,
+    const AllreduceCoalescedOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::allreduce_coalesced(tensors, opts);
+    this->record_collective(OpType::ALLREDUCE_COALESCED, tensors, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::_allgather_base(
+    at::Tensor &outputBuffer,
+    at::Tensor &inputBuffer,
+    const AllgatherOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::_allgather_base(outputBuffer, inputBuffer, opts);
+    this->record_collective(OpType::_ALLGATHER_BASE, {inputBuffer}, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::allgather_coalesced(
+    std::vector<std::vector<at::Tensor>> &outputTensorLists,
+    std::vector<at::Tensor> &inputTensors,
+    const AllgatherOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::allgather_coalesced(outputTensorLists, inputTensors, opts);
+    this->record_collective(OpType::ALLGATHER_COALESCED, inputTensors, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::_reduce_scatter_base(
+    at::Tensor &outputTensor,
+    at::Tensor &inputTensor,
+    const ReduceScatterOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::_reduce_scatter_base(outputTensor, inputTensor, opts);
+    this->record_collective(OpType::_REDUCE_SCATTER_BASE, {inputTensor}, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::alltoall_base(
+    at::Tensor &outputTensor,
+    at::Tensor &inputTensor,
+    std::vector<int64_t> &outputCounts,
+    std::vector<int64_t> &inputCounts,
+    const AllToAllOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::alltoall_base(outputTensor, inputTensor, outputCounts, inputCounts, opts);
+    this->record_collective(OpType::ALLTOALL_BASE, {inputTensor}, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::gather(
+    std::vector<std::vector<at::Tensor>> &outputs,
+    std::vector<at::Tensor> &inputs,
+    const GatherOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::gather(outputs, inputs, opts);
+    this->record_collective(OpType::GATHER, inputs, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::scatter(
+    std::vector<at::Tensor> &outputs,
+    std::vector<std::vector<at::Tensor>> &inputs,
+    const ScatterOptions &opts)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::scatter(outputs, inputs, opts);
+    this->record_collective(OpType::SCATTER, outputs, start, work);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::send(
+    std::vector<at::Tensor> &tensors,
+    int dstRank,
+    int tag)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::send(tensors, dstRank, tag);
+    this->record_collective(OpType::SEND, tensors, start);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::recv(
+    std::vector<at::Tensor> &tensors,
+    int srcRank,
+    int tag)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::recv(tensors, srcRank, tag);
+    this->record_collective(OpType::RECV, tensors, start);
+    return work;
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::recvAnysource(
+    std::vector<at::Tensor> &tensors,
+    int tag)
+  {
+    auto start = std::chrono::steady_clock::now();
+    auto work = ProcessGroupGloo::recvAnysource(tensors, tag);
+    this->record_collective(OpType::RECVANYSOURCE, tensors, start);
+    return work;
+  }
+
+  void WebGPUBackend::sparse_allreduce(at::Tensor &tensor, int64_t bucket)
+  {
+    if (bucket < 0) {
+      throw std::invalid_argument("bucket must be non-negative");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<at::Tensor> tensors = {tensor};
+    auto work = this->allreduce_listener(tensors, bucket);
+    work->wait();
+    work->synchronize();
+    this->record_collective(OpType::ALLREDUCE, tensors, start);
+  }
+
+  c10::intrusive_ptr<Work> WebGPUBackend::allreduce_listener(
+    std::vector<at::Tensor> &tensors, int64_t sparsify_bucket)
   {
     // 2. Create future to handle async completion
     auto future = c10::make_intrusive<c10::ivalue::Future>(
@@ -256,7 +840,101 @@ namespace c10d
     future->markCompleted(c10::IValue(tensors));
 
     return c10::make_intrusive<WebGPUBackendWork>(OpType::ALLREDUCE, tensors, this->m_rank, 
-      this->m_world_size, std::move(future));
+      this->m_world_size, this, std::move(future), sparsify_bucket);
+  }
+
+  void WebGPUBackend::calibrate_algorithm_selection(const std::vector<size_t> &message_bytes,
+      int iterations, const at::Device &device) {
+    if (message_bytes.empty() || iterations <= 0) {
+      throw std::invalid_argument("Calibration needs at least one message size and iteration");
+    }
+
+    std::vector<size_t> sizes = message_bytes;
+    std::sort(sizes.begin(), sizes.end());
+
+    // [listener_0, gloo_0, listener_1, gloo_1, ...] mean seconds per call.
+    auto timings = at::zeros({static_cast<int64_t>(2 * sizes.size())}, at::kDouble);
+    for (size_t i = 0; i < sizes.size(); i++) {
+      auto numel = static_cast<int64_t>(std::max<size_t>(sizes[i] / sizeof(float), 1));
+      std::vector<at::Tensor> tensors = {at::ones({numel}, at::TensorOptions().dtype(at::kFloat).device(device))};
+
+      for (int path = 0; path < 2; path++) {
+        // One untimed warm-up round per path.
+        for (int iteration = 0; iteration <= iterations; iteration++) {
+          auto start = std::chrono::steady_clock::now();
+          auto work = path == 0 ? this->allreduce_listener(tensors)
+              : ProcessGroupGloo::allreduce(tensors);
+          work->wait();
+          work->synchronize();
+          std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+          if (iteration > 0) {
+            timings[2 * i + path] += elapsed.count() / iterations;
+          }
+        }
+      }
+    }
+
+    // Every rank has to end up with the same table, so decide on the
+    // slowest rank's timings.
+    std::vector<at::Tensor> agreed = {timings};
+    AllreduceOptions max_opts;
+    max_opts.reduceOp = ReduceOp::MAX;
+    ProcessGroupGloo::allreduce(agreed, max_opts)->wait();
+
+    // Gloo is used below the first size at which the listener wins, and for
+    // every size if the listener never does: nothing was measured that
+    // would justify switching above the largest size.
+    size_t crossover = SIZE_MAX;
+    for (size_t i = 0; i < sizes.size(); i++) {
+      if (timings[2 * i].item<double>() <= timings[2 * i + 1].item<double>()) {
+        crossover = sizes[i];
+        break;
+      }
+    }
+    this->m_algorithm_selector.set_crossover(this->m_world_size, crossover);
+
+    if (crossover == SIZE_MAX) {
+      fmt::print("Calibrated allreduce crossover for world size {}: Gloo at every size\n", this->m_world_size);
+    } else {
+      fmt::print("Calibrated allreduce crossover for world size {}: {} bytes\n", this->m_world_size, crossover);
+    }
+  }
+
+  void WebGPUBackend::record_collective(OpType op, const std::vector<at::Tensor> &tensors,
+      std::chrono::steady_clock::time_point start, const c10::intrusive_ptr<Work> &gloo_work) {
+    std::shared_ptr<CollectiveTraceRecorder> recorder = this->m_trace_recorder;
+    if (!recorder) {
+      return;
+    }
+
+    std::vector<TraceTensor> traced;
+    traced.reserve(tensors.size());
+    for (const auto &tensor : tensors) {
+      traced.push_back({static_cast<uint64_t>(tensor.numel()),
+          static_cast<int8_t>(tensor.scalar_type())});
+    }
+
+    if (!gloo_work) {
+      recorder->record(static_cast<uint8_t>(op), traced, start, std::chrono::steady_clock::now());
+      return;
+    }
+
+    // Gloo work only enqueues the collective, its duration ends when the
+    // future completes.
+    gloo_work->getFuture()->addCallback(
+        [recorder, op, traced = std::move(traced), start](c10::ivalue::Future &) {
+          recorder->record(static_cast<uint8_t>(op), traced, start, std::chrono::steady_clock::now());
+        });
+  }
+
+  void WebGPUBackend::enable_trace(const std::string &path) {
+    this->m_trace_recorder = std::make_shared<CollectiveTraceRecorder>(path, this->m_rank, this->m_world_size);
+
+    fmt::print("Recording collectives of rank {} to {}\n", this->m_rank, path);
+  }
+
+  void WebGPUBackend::disable_trace() {
+    this->m_trace_recorder.reset();
   }
 
   void WebGPUBackend::configure_backend(bool use_quantization,
@@ -266,6 +944,12 @@ namespace c10d
             use_quantization, use_scaling, straggler_aware);
   }
 
+  void WebGPUBackend::configure_sparsification(float topk_ratio) {
+    this->m_sparsifier.set_ratio(topk_ratio);
+
+    fmt::print("Configuring WebGPUBackend with top-k ratio: {}\n", topk_ratio);
+  }
+
   c10::intrusive_ptr<Backend> WebGPUBackend::createWebGPUBackend(
       const c10::intrusive_ptr<::c10d::Store> &store,
       int rank,
@@ -275,7 +959,7 @@ namespace c10d
     auto options = c10d::ProcessGroupGloo::Options::create();
     options->devices.push_back(
         ::c10d::ProcessGroupGloo::createDeviceForHostname("127.0.0.1"));
-    return c10::make_intrusive<IncBackend>(store, rank, size, timeout, options);
+    return c10::make_intrusive<WebGPUBackend>(store, rank, size, timeout, options);
   }
 
   PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
@@ -291,6 +975,97 @@ namespace c10d
     },
     "Configure the WebGPUBackend with quantization, scaling, and straggler awareness options.",
     py::arg("use_quantization"), py::arg("use_scaling"), py::arg("straggler_aware"));
+
+    m.def("configure_sparsification", [](float topk_ratio) {
+        if (!g_current_webgpu_backend) {
+            throw std::runtime_error("No WebGPUBackend instance found. Make sure you initialized with backend='webgpu_backend'.");
+        }
+
+        g_current_webgpu_backend->configure_sparsification(topk_ratio);
+    },
+    "Enable top-k gradient sparsification with error feedback for sparse_allreduce. A ratio of 0 disables it.",
+    py::arg("topk_ratio"));
+
+    m.def("sparse_allreduce", [](at::Tensor tensor, int64_t bucket) {
+        if (!g_current_webgpu_backend) {
+            throw std::runtime_error("No WebGPUBackend instance found. Make sure you initialized with backend='webgpu_backend'.");
+        }
+        g_current_webgpu_backend->sparse_allreduce(tensor, bucket);
+        return tensor;
+    },
+    "Sum `tensor` over all ranks through the listener, keeping only the top-k entries and carrying the rest over to the next call with the same `bucket` (e.g. the DDP bucket index).",
+    py::arg("tensor"), py::arg("bucket"), py::call_guard<py::gil_scoped_release>());
+
+    m.def("enable_trace", [](const std::string &path) {
+        if (!g_current_webgpu_backend) {
+            throw std::runtime_error("No WebGPUBackend instance found. Make sure you initialized with backend='webgpu_backend'.");
+        }
+
+        g_current_webgpu_backend->enable_trace(path);
+    },
+    "Record every collective of this rank to a binary trace file for offline replay.",
+    py::arg("path"));
+
+    m.def("staging_pool_stats", []() {
+        py::dict stats;
+#ifdef IS_CUDA_BUILD
+        if (g_current_webgpu_backend) {
+            auto &pool = g_current_webgpu_backend->staging_pool();
+            stats["pinned_allocations"] = pool.pinned_allocations();
+            stats["pinned_bytes"] = pool.pinned_bytes();
+            stats["pageable_fallbacks"] = pool.pageable_fallbacks();
+        }
+#endif
+        return stats;
+    },
+    "Pinned host staging pool counters. Empty on CPU-only builds.");
+
+    m.def("configure_algorithm_selection", [](const std::map<int, size_t> &crossover_bytes) {
+        if (!g_current_webgpu_backend) {
+            throw std::runtime_error("No WebGPUBackend instance found. Make sure you initialized with backend='webgpu_backend'.");
+        }
+
+        auto &selector = g_current_webgpu_backend->algorithm_selector();
+        selector.clear();
+        for (const auto &entry : crossover_bytes) {
+            selector.set_crossover(entry.first, entry.second);
+        }
+    },
+    "Set the allreduce crossover table, mapping world size to the message size in bytes below which Gloo is used. Must be identical on every rank.",
+    py::arg("crossover_bytes"));
+
+    m.def("calibrate_algorithm_selection", [](const std::vector<size_t> &message_bytes, int iterations, const std::string &device) {
+        if (!g_current_webgpu_backend) {
+            throw std::runtime_error("No WebGPUBackend instance found. Make sure you initialized with backend='webgpu_backend'.");
+        }
+
+        g_current_webgpu_backend->calibrate_algorithm_selection(message_bytes, iterations, at::Device(device));
+        return g_current_webgpu_backend->algorithm_selector().crossover_table();
+    },
+    "Measure both allreduce paths and store the crossover for the current world size. Must be called on every rank.",
+    py::arg("message_bytes") = std::vector<size_t>{64, 1024, 16 * 1024, 256 * 1024, 4 * 1024 * 1024},
+    py::arg("iterations") = 5, py::arg("device") = "cpu");
+
+    m.def("algorithm_stats", []() {
+        py::dict stats;
+        if (g_current_webgpu_backend) {
+            auto &selector = g_current_webgpu_backend->algorithm_selector();
+            stats["listener_calls"] = selector.calls(AllreduceAlgorithm::LISTENER);
+            stats["listener_bytes"] = selector.bytes(AllreduceAlgorithm::LISTENER);
+            stats["gloo_calls"] = selector.calls(AllreduceAlgorithm::GLOO);
+            stats["gloo_bytes"] = selector.bytes(AllreduceAlgorithm::GLOO);
+            stats["crossover_bytes"] = selector.crossover_table();
+        }
+        return stats;
+    },
+    "Per-path allreduce call and byte counts, and the crossover table in use.");
+
+    m.def("disable_trace", []() {
+        if (g_current_webgpu_backend) {
+            g_current_webgpu_backend->disable_trace();
+        }
+    },
+    "Stop recording collectives and close the trace file.");
   }
 
 }
\ No newline at end of file
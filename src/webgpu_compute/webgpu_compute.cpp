@@ -1,15 +1,49 @@
 #include "webgpu_compute/webgpu_compute.hpp"
 
-WebGPUCompute::WebGPUCompute() {
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+
+#define PARAMS_BUFFER_SIZE 16
+#define MIN_BUFFER_SIZE 16
+
+WebGPUCompute::WebGPUCompute(size_t max_in_flight)
+    : slots(std::max<size_t>(max_in_flight, 1)) {
+    for (auto& slot : this->slots) {
+        slot.owner = this;
+    }
+
+    // The device and pipeline are created once and shared by every slot,
+    // so a reduction only pays for the upload, dispatch and readback.
+    this->initialize_device();
+    this->initialize_pipeline();
+
+    this->poll_thread = std::thread(&WebGPUCompute::poll_loop, this);
+}
+
+WebGPUCompute::~WebGPUCompute() {
+    {
+        std::lock_guard<std::mutex> lock(this->slots_mutex);
+        this->running = false;
+    }
+    this->work_submitted_cv.notify_all();
+    this->slot_free_cv.notify_all();
+
+    // The poll thread drains every outstanding submission before exiting.
+    if (this->poll_thread.joinable()) {
+        this->poll_thread.join();
+    }
+
+    this->cleanup();
 }
 
 void WebGPUCompute::initialize_device() {
     // 1. Create WebGPU instance and adapter
     WGPUInstanceDescriptor instanceDesc = {};
     this->instance = wgpuCreateInstance(&instanceDesc);
-    
+
     WGPURequestAdapterOptions adapterOpts = {};
-    
+
     auto onAdapterRequestEnded = [](WGPURequestAdapterStatus status, WGPUAdapter adapter, char const* message, void* userdata) {
         if (status == WGPURequestAdapterStatus_Success) {
             *static_cast<WGPUAdapter*>(userdata) = adapter;
@@ -17,131 +51,384 @@ void WebGPUCompute::initialize_device() {
     };
 
     wgpuInstanceRequestAdapter(this->instance, &adapterOpts, onAdapterRequestEnded, &this->adapter);
-    
+
     WGPUDeviceDescriptor deviceDesc = {};
-    
+
     auto onDeviceRequestEnded = [](WGPURequestDeviceStatus status, WGPUDevice device, char const* message, void* userdata) {
         if (status == WGPURequestDeviceStatus_Success) {
             *static_cast<WGPUDevice*>(userdata) = device;
         }
     };
     wgpuAdapterRequestDevice(this->adapter, &deviceDesc, onDeviceRequestEnded, &this->device);
+
+    this->queue = wgpuDeviceGetQueue(this->device);
 }
 
-void WebGPUCompute::create_buffers(std::vector<float>& a, std::vector<float>& b) {
-    size_t bufferSize = size * sizeof(float);
-    
-    WGPUBufferDescriptor bufferDescA = {};
-    bufferDescA.size = bufferSize;
-    bufferDescA.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
-    this->bufferA = wgpuDeviceCreateBuffer(this->device, &bufferDescA);
-    
-    WGPUBufferDescriptor bufferDescB = {};
-    bufferDescB.size = bufferSize;
-    bufferDescB.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
-    this->bufferB = wgpuDeviceCreateBuffer(this->device, &bufferDescB);
-    
+void WebGPUCompute::create_buffers(InFlightSlot& slot, size_t inputSize, size_t resultSize, size_t sparseSize) {
+    this->release_buffers(slot);
+
+    WGPUBufferDescriptor inputBufferDesc = {};
+    inputBufferDesc.size = inputSize;
+    inputBufferDesc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
+    slot.inputBuffer = wgpuDeviceCreateBuffer(this->device, &inputBufferDesc);
+
+    WGPUBufferDescriptor paramsBufferDesc = {};
+    paramsBufferDesc.size = PARAMS_BUFFER_SIZE;
+    paramsBufferDesc.usage = WGPUBufferUsage_Uniform | WGPUBufferUsage_CopyDst;
+    slot.paramsBuffer = wgpuDeviceCreateBuffer(this->device, &paramsBufferDesc);
+
     WGPUBufferDescriptor bufferDescResult = {};
-    bufferDescResult.size = bufferSize;
+    bufferDescResult.size = resultSize;
     bufferDescResult.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopySrc;
-    this->bufferResult = wgpuDeviceCreateBuffer(this->device, &bufferDescResult);
-    
+    slot.bufferResult = wgpuDeviceCreateBuffer(this->device, &bufferDescResult);
+
     WGPUBufferDescriptor stagingBufferDesc = {};
-    stagingBufferDesc.size = bufferSize;
+    stagingBufferDesc.size = resultSize;
     stagingBufferDesc.usage = WGPUBufferUsage_MapRead | WGPUBufferUsage_CopyDst;
-    this->stagingBuffer = wgpuDeviceCreateBuffer(this->device, &stagingBufferDesc);
-    
-    wgpuQueueWriteBuffer(wgpuDeviceGetQueue(this->device), this->bufferA, 0, a.data(), bufferSize);
-    wgpuQueueWriteBuffer(wgpuDeviceGetQueue(this->device), this->bufferB, 0, b.data(), bufferSize);
+    slot.stagingBuffer = wgpuDeviceCreateBuffer(this->device, &stagingBufferDesc);
+
+    WGPUBufferDescriptor sparseBufferDesc = {};
+    sparseBufferDesc.size = sparseSize;
+    sparseBufferDesc.usage = WGPUBufferUsage_Storage | WGPUBufferUsage_CopyDst;
+    slot.sparseBuffer = wgpuDeviceCreateBuffer(this->device, &sparseBufferDesc);
+
+    slot.inputCapacity = inputSize;
+    slot.resultCapacity = resultSize;
+    slot.sparseCapacity = sparseSize;
+
+    this->create_bind_group(slot);
+}
+
+void WebGPUCompute::release_buffers(InFlightSlot& slot) {
+    if (slot.bindGroup) wgpuBindGroupRelease(slot.bindGroup);
+    if (slot.scatterBindGroup) wgpuBindGroupRelease(slot.scatterBindGroup);
+    if (slot.inputBuffer) wgpuBufferRelease(slot.inputBuffer);
+    if (slot.paramsBuffer) wgpuBufferRelease(slot.paramsBuffer);
+    if (slot.bufferResult) wgpuBufferRelease(slot.bufferResult);
+    if (slot.stagingBuffer) wgpuBufferRelease(slot.stagingBuffer);
+    if (slot.sparseBuffer) wgpuBufferRelease(slot.sparseBuffer);
+
+    slot.bindGroup = nullptr;
+    slot.scatterBindGroup = nullptr;
+    slot.inputBuffer = nullptr;
+    slot.paramsBuffer = nullptr;
+    slot.bufferResult = nullptr;
+    slot.stagingBuffer = nullptr;
+    slot.sparseBuffer = nullptr;
+    slot.inputCapacity = 0;
+    slot.resultCapacity = 0;
+    slot.sparseCapacity = 0;
 }
 
 void WebGPUCompute::initialize_pipeline() {
     WGPUShaderModuleWGSLDescriptor wgslDesc = {};
     wgslDesc.chain.sType = WGPUSType_ShaderModuleWGSLDescriptor;
     wgslDesc.code = shaderCode;
-    
+
     WGPUShaderModuleDescriptor shaderDesc = {};
     shaderDesc.nextInChain = &wgslDesc.chain;
     this->shaderModule = wgpuDeviceCreateShaderModule(this->device, &shaderDesc);
-    
+
     // 6. Create compute pipeline
     WGPUComputePipelineDescriptor pipelineDesc = {};
     pipelineDesc.compute.module = this->shaderModule;
-    pipelineDesc.compute.entryPoint = this->shaderEntryPoint;
+    pipelineDesc.compute.entryPoint = this->shaderEntryPoint.c_str();
     this->pipeline = wgpuDeviceCreateComputePipeline(this->device, &pipelineDesc);
+
+    WGPUComputePipelineDescriptor scatterPipelineDesc = {};
+    scatterPipelineDesc.compute.module = this->shaderModule;
+    scatterPipelineDesc.compute.entryPoint = this->scatterEntryPoint.c_str();
+    this->scatterPipeline = wgpuDeviceCreateComputePipeline(this->device, &scatterPipelineDesc);
 }
 
-void WebGPUCompute::create_bind_group() {
+void WebGPUCompute::create_bind_group(InFlightSlot& slot) {
     WGPUBindGroupEntry entries[3] = {};
     entries[0].binding = 0;
-    entries[0].buffer = bufferA;
-    entries[0].size = bufferSize;
+    entries[0].buffer = slot.inputBuffer;
+    entries[0].size = slot.inputCapacity;
     entries[1].binding = 1;
-    entries[1].buffer = bufferB;
-    entries[1].size = bufferSize;
+    entries[1].buffer = slot.paramsBuffer;
+    entries[1].size = PARAMS_BUFFER_SIZE;
     entries[2].binding = 2;
-    entries[2].buffer = bufferResult;
-    entries[2].size = bufferSize;
-    
+    entries[2].buffer = slot.bufferResult;
+    entries[2].size = slot.resultCapacity;
+
     WGPUBindGroupDescriptor bindGroupDesc = {};
-    bindGroupDesc.layout = wgpuComputePipelineGetBindGroupLayout(pipeline, 0);
+    bindGroupDesc.layout = wgpuComputePipelineGetBindGroupLayout(this->pipeline, 0);
     bindGroupDesc.entryCount = 3;
     bindGroupDesc.entries = entries;
-    this->bindGroup = wgpuDeviceCreateBindGroup(device, &bindGroupDesc);
+    slot.bindGroup = wgpuDeviceCreateBindGroup(this->device, &bindGroupDesc);
+
+    // The scatter pipeline's layout is derived from `scatter_add` and only
+    // contains the bindings that entry point uses.
+    WGPUBindGroupEntry scatterEntries[3] = {};
+    scatterEntries[0].binding = 1;
+    scatterEntries[0].buffer = slot.paramsBuffer;
+    scatterEntries[0].size = PARAMS_BUFFER_SIZE;
+    scatterEntries[1].binding = 2;
+    scatterEntries[1].buffer = slot.bufferResult;
+    scatterEntries[1].size = slot.resultCapacity;
+    scatterEntries[2].binding = 3;
+    scatterEntries[2].buffer = slot.sparseBuffer;
+    scatterEntries[2].size = slot.sparseCapacity;
+
+    WGPUBindGroupDescriptor scatterBindGroupDesc = {};
+    scatterBindGroupDesc.layout = wgpuComputePipelineGetBindGroupLayout(this->scatterPipeline, 0);
+    scatterBindGroupDesc.entryCount = 3;
+    scatterBindGroupDesc.entries = scatterEntries;
+    slot.scatterBindGroup = wgpuDeviceCreateBindGroup(this->device, &scatterBindGroupDesc);
 }
 
 std::vector<float> WebGPUCompute::perform_aggregation(std::vector<std::vector<float>> data) {
-    std::vector<float> result(data[0].size(), 0.0f);
-    for (int i =0; i< data.size(); i++) {
-        this->webgpu_vector_addition(result, data[i], result);
+    return this->perform_aggregation_async(std::move(data)).get();
+}
+
+std::future<std::vector<float>> WebGPUCompute::perform_aggregation_async(std::vector<std::vector<float>> data) {
+    auto promise = std::make_shared<std::promise<std::vector<float>>>();
+    auto future = promise->get_future();
+
+    this->perform_aggregation_async(std::move(data),
+        [promise](std::vector<float> result, std::exception_ptr error) {
+            if (error) {
+                promise->set_exception(error);
+            } else {
+                promise->set_value(std::move(result));
+            }
+        });
+
+    return future;
+}
+
+void WebGPUCompute::perform_aggregation_async(std::vector<std::vector<float>> data, AggregationCallback on_complete) {
+    size_t length = data.empty() ? 0 : data[0].size();
+    this->perform_sparse_aggregation_async(length, std::move(data), {}, std::move(on_complete));
+}
+
+void WebGPUCompute::perform_sparse_aggregation_async(size_t length,
+    std::vector<std::vector<float>> dense,
+    std::vector<SparseContribution> sparse,
+    AggregationCallback on_complete) {
+    if (length == 0) {
+        on_complete({}, nullptr);
+        return;
+    }
+
+    for (const auto& contribution : dense) {
+        if (contribution.size() != length) {
+            throw std::invalid_argument("All contributions must have the same length");
+        }
+    }
+
+    // Group the sparse entries of every contribution by destination index:
+    // [segment indices][segment offsets][value bits].
+    std::vector<std::pair<uint32_t, float>> entries;
+    for (const auto& contribution : sparse) {
+        if (contribution.indices.size() != contribution.values.size()) {
+            throw std::invalid_argument("Sparse contribution has mismatched indices and values");
+        }
+        for (size_t i = 0; i < contribution.indices.size(); i++) {
+            if (contribution.indices[i] >= length) {
+                throw std::out_of_range("Sparse index " + std::to_string(contribution.indices[i]) + " out of range");
+            }
+            entries.emplace_back(contribution.indices[i], contribution.values[i]);
+        }
+    }
+    std::stable_sort(entries.begin(), entries.end(),
+        [](const auto& a, const auto& b) { return a.first < b.first; });
+
+    std::vector<uint32_t> segmentIndices;
+    std::vector<uint32_t> segmentOffsets;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (i == 0 || entries[i].first != entries[i - 1].first) {
+            segmentIndices.push_back(entries[i].first);
+            segmentOffsets.push_back(static_cast<uint32_t>(i));
+        }
     }
-    return result;
+    segmentOffsets.push_back(static_cast<uint32_t>(entries.size()));
+
+    std::vector<uint32_t> packed;
+    packed.reserve(segmentIndices.size() + segmentOffsets.size() + entries.size());
+    packed.insert(packed.end(), segmentIndices.begin(), segmentIndices.end());
+    packed.insert(packed.end(), segmentOffsets.begin(), segmentOffsets.end());
+    for (const auto& entry : entries) {
+        uint32_t bits;
+        std::memcpy(&bits, &entry.second, sizeof(bits));
+        packed.push_back(bits);
+    }
+
+    InFlightSlot& slot = this->acquire_slot();
+    slot.on_complete = std::move(on_complete);
+    this->submit(slot, length, dense, packed, static_cast<uint32_t>(segmentIndices.size()));
 }
 
-void WebGPUCompute::webgpu_vector_addition(std::vector<float>& a, std::vector<float>& b, std::vector<float>& result) {
-    size_t size = a.size();
-    result.resize(size);
+WebGPUCompute::InFlightSlot& WebGPUCompute::acquire_slot() {
+    std::unique_lock<std::mutex> lock(this->slots_mutex);
+
+    // Backpressure: when every slot is still being reduced the caller waits
+    // for the poll thread to hand one back.
+    this->slot_free_cv.wait(lock, [this] {
+        return std::any_of(this->slots.begin(), this->slots.end(),
+            [](const InFlightSlot& slot) { return !slot.busy; });
+    });
+
+    while (this->slots[this->next_slot].busy) {
+        this->next_slot = (this->next_slot + 1) % this->slots.size();
+    }
+
+    InFlightSlot& slot = this->slots[this->next_slot];
+    this->next_slot = (this->next_slot + 1) % this->slots.size();
+    slot.busy = true;
+    slot.mapped = false;
+    // Counted before the map is requested, since a poll already running for
+    // another slot may fire its callback and complete it right away.
+    this->in_flight++;
+    return slot;
+}
+
+void WebGPUCompute::submit(InFlightSlot& slot, size_t length,
+    const std::vector<std::vector<float>>& dense,
+    const std::vector<uint32_t>& sparse, uint32_t segments) {
+    size_t size = length;
+    size_t contributionSize = size * sizeof(float);
+    size_t inputSize = std::max<size_t>(contributionSize * dense.size(), MIN_BUFFER_SIZE);
+    size_t sparseSize = std::max<size_t>(sparse.size() * sizeof(uint32_t), MIN_BUFFER_SIZE);
+
+    if (slot.inputCapacity < inputSize || slot.resultCapacity < contributionSize || slot.sparseCapacity < sparseSize) {
+        this->create_buffers(slot,
+            std::max(inputSize, slot.inputCapacity),
+            std::max(contributionSize, slot.resultCapacity),
+            std::max(sparseSize, slot.sparseCapacity));
+    }
+    slot.length = size;
+
+    for (size_t k = 0; k < dense.size(); k++) {
+        wgpuQueueWriteBuffer(this->queue, slot.inputBuffer, k * contributionSize, dense[k].data(), contributionSize);
+    }
+    if (segments > 0) {
+        wgpuQueueWriteBuffer(this->queue, slot.sparseBuffer, 0, sparse.data(), sparse.size() * sizeof(uint32_t));
+    }
+
+    uint32_t params[PARAMS_BUFFER_SIZE / sizeof(uint32_t)] = {
+        static_cast<uint32_t>(size), static_cast<uint32_t>(dense.size()),
+        segments, static_cast<uint32_t>(sparse.size() - 2 * segments - 1)};
+    wgpuQueueWriteBuffer(this->queue, slot.paramsBuffer, 0, params, sizeof(params));
 
-    this->initialize_device();
-    this->create_buffers(a, b);
-    this->initialize_pipeline();
-    this->create_bind_group();
-    
     // 8. Create command encoder and compute pass
     WGPUCommandEncoder encoder = wgpuDeviceCreateCommandEncoder(this->device, nullptr);
     WGPUComputePassEncoder computePass = wgpuCommandEncoderBeginComputePass(encoder, nullptr);
     wgpuComputePassEncoderSetPipeline(computePass, this->pipeline);
-    wgpuComputePassEncoderSetBindGroup(computePass, 0, this->bindGroup, 0, nullptr);
+    wgpuComputePassEncoderSetBindGroup(computePass, 0, slot.bindGroup, 0, nullptr);
     wgpuComputePassEncoderDispatchWorkgroups(computePass, (size + 63) / 64, 1, 1);
+    if (segments > 0) {
+        wgpuComputePassEncoderSetPipeline(computePass, this->scatterPipeline);
+        wgpuComputePassEncoderSetBindGroup(computePass, 0, slot.scatterBindGroup, 0, nullptr);
+        wgpuComputePassEncoderDispatchWorkgroups(computePass, (segments + 63) / 64, 1, 1);
+    }
     wgpuComputePassEncoderEnd(computePass);
-    
+
     // 9. Copy result to staging buffer
-    wgpuCommandEncoderCopyBufferToBuffer(encoder, this->bufferResult, 0, this->stagingBuffer, 0, this->bufferSize);
-    
+    wgpuCommandEncoderCopyBufferToBuffer(encoder, slot.bufferResult, 0, slot.stagingBuffer, 0, contributionSize);
+
     WGPUCommandBuffer commands = wgpuCommandEncoderFinish(encoder, nullptr);
-    wgpuQueueSubmit(wgpuDeviceGetQueue(this->device), 1, &commands);
-    
-    // 10. Read back results
-    wgpuBufferMapAsync(this->stagingBuffer, WGPUMapMode_Read, 0, this->bufferSize, 
-        [](WGPUBufferMapAsyncStatus status, void* userdata) {}, nullptr);
-    wgpuDevicePoll(this->device, true, nullptr);
-    
-    const float* mappedData = static_cast<const float*>(wgpuBufferGetConstMappedRange(this->stagingBuffer, 0, this->bufferSize));
-    std::copy(mappedData, mappedData + size, result.begin());
-    wgpuBufferUnmap(this->stagingBuffer);
+    wgpuQueueSubmit(this->queue, 1, &commands);
 
-    this->cleanup();
+    wgpuCommandBufferRelease(commands);
+    wgpuComputePassEncoderRelease(computePass);
+    wgpuCommandEncoderRelease(encoder);
+
+    // 10. Read back results. The callback only flags the slot; the poll
+    // thread copies the data out once wgpuDevicePoll has returned.
+    wgpuBufferMapAsync(slot.stagingBuffer, WGPUMapMode_Read, 0, contributionSize,
+        [](WGPUBufferMapAsyncStatus status, void* userdata) {
+            auto* slot = static_cast<InFlightSlot*>(userdata);
+            std::lock_guard<std::mutex> lock(slot->owner->slots_mutex);
+            slot->mapStatus = status;
+            slot->mapped = true;
+        }, &slot);
+
+    this->work_submitted_cv.notify_one();
+}
+
+void WebGPUCompute::poll_loop() {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->slots_mutex);
+            this->work_submitted_cv.wait(lock, [this] {
+                return !this->running || this->in_flight > 0;
+            });
+            if (!this->running && this->in_flight == 0) {
+                return;
+            }
+        }
+
+        // Blocks until the queue has drained the submissions made so far and
+        // fires their map callbacks. Callers keep submitting into free slots
+        // meanwhile.
+        wgpuDevicePoll(this->device, true, nullptr);
+
+        std::vector<InFlightSlot*> ready;
+        {
+            std::lock_guard<std::mutex> lock(this->slots_mutex);
+            for (auto& slot : this->slots) {
+                if (slot.busy && slot.mapped) {
+                    ready.push_back(&slot);
+                }
+            }
+        }
+
+        for (auto* slot : ready) {
+            this->complete(*slot);
+        }
+    }
+}
+
+void WebGPUCompute::complete(InFlightSlot& slot) {
+    std::vector<float> result;
+    std::exception_ptr error;
+
+    if (slot.mapStatus == WGPUBufferMapAsyncStatus_Success) {
+        size_t resultSize = slot.length * sizeof(float);
+        const float* mappedData = static_cast<const float*>(wgpuBufferGetConstMappedRange(slot.stagingBuffer, 0, resultSize));
+        result.assign(mappedData, mappedData + slot.length);
+        wgpuBufferUnmap(slot.stagingBuffer);
+    } else {
+        error = std::make_exception_ptr(std::runtime_error(
+            "Failed to map staging buffer, status " + std::to_string(slot.mapStatus)));
+    }
+
+    AggregationCallback on_complete = std::move(slot.on_complete);
+    {
+        std::lock_guard<std::mutex> lock(this->slots_mutex);
+        slot.busy = false;
+        slot.mapped = false;
+        slot.on_complete = nullptr;
+    }
+    this->slot_free_cv.notify_one();
+
+    on_complete(std::move(result), error);
+
+    // Only after the callback, so drain() returns once results are out.
+    {
+        std::lock_guard<std::mutex> lock(this->slots_mutex);
+        this->in_flight--;
+    }
+    this->drained_cv.notify_all();
+}
+
+void WebGPUCompute::drain() {
+    std::unique_lock<std::mutex> lock(this->slots_mutex);
+    this->drained_cv.wait(lock, [this] { return this->in_flight == 0; });
 }
 
 void WebGPUCompute::cleanup() {
-    wgpuBufferRelease(this->bufferA);
-    wgpuBufferRelease(this->bufferB);
-    wgpuBufferRelease(this->bufferResult);
-    wgpuBufferRelease(this->stagingBuffer);
-    wgpuBindGroupRelease(this->bindGroup);
+    for (auto& slot : this->slots) {
+        this->release_buffers(slot);
+    }
     wgpuComputePipelineRelease(this->pipeline);
+    wgpuComputePipelineRelease(this->scatterPipeline);
     wgpuShaderModuleRelease(this->shaderModule);
+    wgpuQueueRelease(this->queue);
     wgpuDeviceRelease(this->device);
     wgpuAdapterRelease(this->adapter);
     wgpuInstanceRelease(this->instance);
-}
\ No newline at end of file
+}
@@ -1,18 +1,37 @@
 #include "webgpu_tcp_listener.hpp"
 
+static void usage(const char *argv0) {
+    std::cerr << "Usage: " << argv0 << " <port> [--no-shm] [--memory-budget-mb <mb>] [--round-timeout-ms <ms>]\n";
+}
+
 int main(int argc, char* argv[]) {
     try {
         if (argc < 2) {
-            std::cerr << "Usage: " << argv[0] << " <port>\n";
+            usage(argv[0]);
             return 1;
         }
 
         int port = std::stoi(argv[1]);
-        WebGPUTcpListener server(port);
+        bool enable_shm = true;
+        size_t memory_budget_mb = DEFAULT_MEMORY_BUDGET_MB;
+        long round_timeout_ms = DEFAULT_ROUND_TIMEOUT_MS;
+        for (int i = 2; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "--no-shm") enable_shm = false;
+            else if (arg == "--memory-budget-mb" && i + 1 < argc) memory_budget_mb = std::stoul(argv[++i]);
+            else if (arg == "--round-timeout-ms" && i + 1 < argc) round_timeout_ms = std::stol(argv[++i]);
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+
+        WebGPUTcpListener server(port, enable_shm, memory_budget_mb * 1024 * 1024,
+            std::chrono::milliseconds(round_timeout_ms));
         server.run();
     } catch (const std::exception& e) {
         std::cout << "Error: " << e.what() << "\n";
         return 1;
     }
     return 0;
-}
\ No newline at end of file
+}
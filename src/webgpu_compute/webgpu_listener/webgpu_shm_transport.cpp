@@ -0,0 +1,182 @@
+#include "webgpu_compute/webgpu_listener/webgpu_shm_transport.hpp"
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <stdexcept>
+#include <utility>
+
+uint64_t shm_client_id(uint32_t group, int rank)
+{
+    return (static_cast<uint64_t>(group) << 32) | (static_cast<uint32_t>(rank) + 1);
+}
+
+std::string shm_control_name(int port)
+{
+    return "/webgpu_listener_" + std::to_string(port);
+}
+
+std::string shm_client_name(int port, uint64_t client_id)
+{
+    uint32_t group = static_cast<uint32_t>(client_id >> 32);
+    uint32_t rank = static_cast<uint32_t>(client_id) - 1;
+    return "/webgpu_listener_" + std::to_string(port) + "_group" + std::to_string(group) + "_rank" +
+        std::to_string(rank);
+}
+
+ShmRegion::~ShmRegion()
+{
+    reset();
+}
+
+ShmRegion::ShmRegion(ShmRegion &&other) noexcept
+    : m_name(std::move(other.m_name)),
+      m_data(std::exchange(other.m_data, nullptr)),
+      m_size(std::exchange(other.m_size, 0)),
+      m_owner(std::exchange(other.m_owner, false))
+{
+}
+
+ShmRegion &ShmRegion::operator=(ShmRegion &&other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        m_name = std::move(other.m_name);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_owner = std::exchange(other.m_owner, false);
+    }
+    return *this;
+}
+
+void ShmRegion::reset()
+{
+    if (m_data)
+    {
+        munmap(m_data, m_size);
+        if (m_owner)
+        {
+            shm_unlink(m_name.c_str());
+        }
+    }
+    m_data = nullptr;
+    m_size = 0;
+    m_owner = false;
+}
+
+ShmRegion ShmRegion::create(const std::string &name, size_t size)
+{
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to create shared memory " + name + ": " + strerror(errno));
+    }
+    if (ftruncate(fd, size) < 0)
+    {
+        close(fd);
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Failed to size shared memory " + name + ": " + strerror(errno));
+    }
+
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        shm_unlink(name.c_str());
+        throw std::runtime_error("Failed to map shared memory " + name + ": " + strerror(errno));
+    }
+
+    // ftruncate already zero-fills, so the atomics start at 0.
+    ShmRegion region;
+    region.m_name = name;
+    region.m_data = data;
+    region.m_size = size;
+    region.m_owner = true;
+    return region;
+}
+
+ShmRegion ShmRegion::open(const std::string &name, size_t size)
+{
+    ShmRegion region;
+    int fd = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd < 0)
+    {
+        return region;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < size)
+    {
+        close(fd);
+        return region;
+    }
+
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return region;
+    }
+
+    region.m_name = name;
+    region.m_data = data;
+    region.m_size = size;
+    return region;
+}
+
+bool shm_ring_push(ShmRing &ring, const char *data, uint32_t length)
+{
+    uint32_t head = ring.head.load(std::memory_order_relaxed);
+    uint32_t tail = ring.tail.load(std::memory_order_acquire);
+    if (head - tail == SHM_RING_SLOTS || length > MAX_DATAGRAM_SIZE)
+    {
+        return false;
+    }
+
+    uint32_t slot = head % SHM_RING_SLOTS;
+    memcpy(ring.slots[slot], data, length);
+    ring.lengths[slot] = length;
+    ring.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool shm_ring_pop(ShmRing &ring, char *data, uint32_t &length)
+{
+    uint32_t tail = ring.tail.load(std::memory_order_relaxed);
+    uint32_t head = ring.head.load(std::memory_order_acquire);
+    if (tail == head)
+    {
+        return false;
+    }
+
+    uint32_t slot = tail % SHM_RING_SLOTS;
+    length = std::min<uint32_t>(ring.lengths[slot], MAX_DATAGRAM_SIZE);
+    memcpy(data, ring.slots[slot], length);
+    ring.tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void shm_futex_wait(std::atomic<uint32_t> &word, uint32_t expected, int timeout_ms)
+{
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_nsec = (timeout_ms % 1000) * 1000000L;
+    // Not FUTEX_PRIVATE_FLAG: the word is shared between processes.
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+void shm_futex_wake(std::atomic<uint32_t> &word)
+{
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
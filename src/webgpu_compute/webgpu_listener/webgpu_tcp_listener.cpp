@@ -1,7 +1,70 @@
-#include "simulated_switch_server.h"
+#include "webgpu_compute/webgpu_listener/webgpu_tcp_listener.hpp"
 
+// Encodes an aggregated chunk as dense floats or (index, value) pairs,
+// whichever is smaller on the wire.
+static std::vector<char> encode_result(const std::vector<float> &result, int32_t contributors,
+    int32_t collective, int32_t offset, int32_t credits)
+{
+    int32_t dense_length = static_cast<int32_t>(result.size());
+    int32_t non_zero = static_cast<int32_t>(std::count_if(result.begin(), result.end(),
+        [](float value) { return value != 0.0f; }));
+    bool sparse = prefer_sparse_encoding(non_zero, dense_length);
+
+    ResponseHeader header;
+    header.contributors = htonl(contributors);
+    header.offset = htonl(offset);
+    header.payload_format = htonl(sparse ? PAYLOAD_SPARSE : PAYLOAD_DENSE);
+    header.data_length = htonl(sparse ? non_zero : dense_length);
+    header.dense_length = htonl(dense_length);
+    header.credits = htonl(credits);
+    header.collective = htonl(collective);
+
+    size_t payload_size = sparse ? non_zero * sizeof(SparseEntry) : dense_length * sizeof(float);
+    std::vector<char> packet(sizeof(ResponseHeader) + payload_size);
+    memcpy(packet.data(), &header, sizeof(header));
+
+    if (sparse)
+    {
+        SparseEntry *entries = reinterpret_cast<SparseEntry *>(packet.data() + sizeof(ResponseHeader));
+        for (int32_t i = 0; i < dense_length; i++)
+        {
+            if (result[i] != 0.0f)
+            {
+                *entries++ = {i, result[i]};
+            }
+        }
+    }
+    else
+    {
+        memcpy(packet.data() + sizeof(ResponseHeader), result.data(), payload_size);
+    }
+
+    return packet;
+}
+
+// Bytes per `data_length` unit of a request payload.
+static size_t payload_entry_size(int32_t payload_format)
+{
+    switch (payload_format)
+    {
+    case PAYLOAD_SPARSE:
+        return sizeof(SparseEntry);
+    case PAYLOAD_MANIFEST:
+        return 1;
+    default:
+        return sizeof(float);
+    }
+}
 
-WebGPUTcpListener::WebGPUTcpListener(int port)
+WebGPUTcpListener::WebGPUTcpListener(int port, bool enable_shm, size_t memory_budget_bytes,
+    std::chrono::milliseconds round_timeout)
+    : port(port),
+      round_timeout(round_timeout),
+      last_expiry_scan(std::chrono::steady_clock::now()),
+      slot_pool(memory_budget_bytes),
+      shm_clients(SHM_MAX_CLIENTS),
+      shm_owners(SHM_MAX_CLIENTS, 0),
+      shm_generations(SHM_MAX_CLIENTS, 0)
 {
     // Create UDP socket
     sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -25,16 +88,45 @@ WebGPUTcpListener::WebGPUTcpListener(int port)
 
     int flags = fcntl(sock_fd, F_GETFL, 0);
     fcntl(sock_fd, F_SETFL, flags | O_NONBLOCK);
+
+    if (enable_shm)
+    {
+        // Colocated ranks find the listener through this segment and fall
+        // back to UDP when it does not exist.
+        shm_control = ShmRegion::create(shm_control_name(port), sizeof(ShmControlSegment));
+        auto *control = shm_control.as<ShmControlSegment>();
+        control->incarnation = (static_cast<uint64_t>(getpid()) << 32) ^
+            static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+        control->magic = SHM_MAGIC;
+        shm_running = true;
+        shm_thread = std::thread(&WebGPUTcpListener::handle_shm, this);
+    }
+    else
+    {
+        // A segment left behind by a crashed listener would keep ranks off UDP.
+        shm_unlink(shm_control_name(port).c_str());
+    }
+}
+
+WebGPUTcpListener::~WebGPUTcpListener()
+{
+    shm_running = false;
+    if (shm_thread.joinable())
+    {
+        shm_thread.join();
+    }
+    webgpu_compute.drain();
+    close(sock_fd);
 }
 
-ReceivedDataContainer &WebGPUTcpListener::store()
+ReceivedDataContainer &WebGPUTcpListener::store(const RoundKey &key)
 {
-    return received_data_unquantized;
+    return rounds[key];
 }
 
 void WebGPUTcpListener::handle_packet()
 {
-    char buffer[1024];
+    char buffer[MAX_DATAGRAM_SIZE];
     struct sockaddr_in client_addr;
     socklen_t client_len = sizeof(client_addr);
 
@@ -52,6 +144,8 @@ void WebGPUTcpListener::handle_packet()
 
         int ready = select(sock_fd + 1, &read_fds, NULL, NULL, &tv);
 
+        expire_rounds();
+
         if (ready < 0)
         {
             std::cerr << "Select error\n";
@@ -62,103 +156,573 @@ void WebGPUTcpListener::handle_packet()
         {
             int bytes_received = recvfrom(sock_fd, buffer, sizeof(buffer), 0,
                                             (struct sockaddr *)&client_addr, &client_len);
-
-            if (bytes_received < sizeof(PacketHeader))
+            if (bytes_received < 0)
             {
-                std::cout << "Packet too small\n";
                 continue;
             }
 
+            ReplyEndpoint reply;
+            reply.client_addr = client_addr;
+            handle_message(buffer, bytes_received, reply);
+        }
+    }
+}
+
+void WebGPUTcpListener::handle_message(char *buffer, size_t bytes_received, const ReplyEndpoint &reply)
+{
+    if (bytes_received < sizeof(PacketHeader))
+    {
+        std::cout << "Packet too small\n";
+        return;
+    }
+
 #ifdef DEBUG
-            std::cout << "Received packet from " << inet_ntoa(client_addr.sin_addr) << "\n";
+    if (reply.shm_client < 0)
+    {
+        std::cout << "Received packet from " << inet_ntoa(reply.client_addr.sin_addr) << "\n";
+    }
+    else
+    {
+        std::cout << "Received shared memory message from client " << reply.shm_client << "\n";
+    }
 #endif
 
-            // Unpack header
-            PacketHeader *header = reinterpret_cast<PacketHeader *>(buffer);
-            header->data_length = ntohl(header->data_length);
-            header->rank = ntohl(header->rank);
-            header->world_size = ntohl(header->world_size);
+    // Unpack header
+    PacketHeader *header = reinterpret_cast<PacketHeader *>(buffer);
+    header->data_length = ntohl(header->data_length);
+    header->rank = ntohl(header->rank);
+    header->world_size = ntohl(header->world_size);
+    header->offset = ntohl(header->offset);
+    header->bit_width = ntohl(header->bit_width);
+    header->quantization_type = ntohl(header->quantization_type);
+    header->payload_format = ntohl(header->payload_format);
+    header->dense_length = ntohl(header->dense_length);
+    header->collective = ntohl(header->collective);
+    header->group = ntohl(header->group);
+
+    size_t entry_size = payload_entry_size(header->payload_format);
+    if (header->data_length < 0 || header->dense_length < 0 ||
+        bytes_received < sizeof(PacketHeader) + header->data_length * entry_size)
+    {
+        std::cout << "Packet truncated\n";
+        return;
+    }
+    bool manifest = header->payload_format == PAYLOAD_MANIFEST;
+    if (header->world_size <= 0 ||
+        header->dense_length > (manifest ? static_cast<int32_t>(MANIFEST_CHUNKS) : SIZE_OF_CHUNK) ||
+        (manifest && header->dense_length > header->data_length * 8) ||
+        header->data_length * entry_size > CONTRIBUTION_SLOT_SIZE)
+    {
+        std::cout << "Packet exceeds the chunk size\n";
+        return;
+    }
 #ifdef DEBUG
-            // print header
-            std::cout << "Received packet with data length " << header->data_length << "\n";
-            std::cout << "Received packet with rank " << header->rank << "\n";
-            std::cout << "Received packet with world size " << header->world_size << "\n";
+    // print header
+    std::cout << "Received packet with data length " << header->data_length << "\n";
+    std::cout << "Received packet with rank " << header->rank << "\n";
+    std::cout << "Received packet with world size " << header->world_size << "\n";
 #endif
-            this->current_world_size = header->world_size;
-            this->current_received_size++;
 
+    process_data(header, buffer + sizeof(PacketHeader), reply);
+}
+
+void WebGPUTcpListener::handle_shm()
+{
+    auto *control = shm_control.as<ShmControlSegment>();
+    char buffer[MAX_DATAGRAM_SIZE];
+    uint32_t length;
+
+    while (shm_running)
+    {
+        uint32_t doorbell = control->doorbell.load(std::memory_order_acquire);
+        bool received = false;
 
-            auto payload_unquantized = std::vector<float>(reinterpret_cast<float *>(buffer + sizeof(PacketHeader)), reinterpret_cast<float *>(buffer + sizeof(PacketHeader) + header->data_length * sizeof(float)));
-            process_data<float_t>(header, payload_unquantized, client_addr);
-            
+        for (int client = 0; client < SHM_MAX_CLIENTS; client++)
+        {
+            // The generation is published after the owner, so a generation
+            // read first belongs to this owner or an earlier one and a
+            // mismatch is caught on the next scan.
+            uint32_t generation = control->clients[client].generation.load(std::memory_order_acquire);
+            uint64_t owner = control->clients[client].owner.load(std::memory_order_acquire);
+            if (owner != shm_owners[client] || generation != shm_generations[client])
+            {
+                // The entry was claimed by another rank, or its rank
+                // attached, detached or reattached since the last scan.
+                std::lock_guard<std::mutex> lock(shm_mutex);
+                shm_clients[client] = generation == 0 || owner == 0 ? ShmRegion()
+                    : ShmRegion::open(shm_client_name(port, owner), sizeof(ShmRankSegment));
+                shm_owners[client] = owner;
+                shm_generations[client] = shm_clients[client].valid() ? generation : 0;
+            }
+            if (!shm_clients[client].valid())
+            {
+                continue;
+            }
+
+            auto *segment = shm_clients[client].as<ShmRankSegment>();
+            ReplyEndpoint reply;
+            reply.shm_client = client;
+            while (shm_ring_pop(segment->requests, buffer, length))
+            {
+                handle_message(buffer, length, reply);
+                received = true;
+            }
         }
+
+        if (!received)
+        {
+            // Ranks ring the doorbell after every request; the timeout only
+            // bounds how long shutdown takes.
+            shm_futex_wait(control->doorbell, doorbell, 100);
+        }
+    }
+}
+
+void WebGPUTcpListener::send_result(const ReplyEndpoint &reply, const std::vector<char> &packet)
+{
+    if (reply.shm_client < 0)
+    {
+        sendto(sock_fd, packet.data(), packet.size(), 0,
+                (struct sockaddr *)&reply.client_addr, sizeof(reply.client_addr));
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(shm_mutex);
+    auto *control = shm_control.as<ShmControlSegment>();
+    ShmClient &entry = control->clients[reply.shm_client];
+    if (!shm_clients[reply.shm_client].valid() ||
+        entry.owner.load(std::memory_order_acquire) != shm_owners[reply.shm_client] ||
+        entry.generation.load(std::memory_order_acquire) != shm_generations[reply.shm_client])
+    {
+        // The rank detached, reattached or was detached below while its
+        // round was being aggregated, or its entry changed hands; handle_shm
+        // remaps it.
+        return;
+    }
+
+    auto *segment = shm_clients[reply.shm_client].as<ShmRankSegment>();
+    // Ranks never have more chunks in flight than the ring holds, so this
+    // only waits if the rank is slow to drain its results. This runs on the
+    // compute poll thread, so a rank that stopped draining is detached
+    // rather than waited for; it reattaches once it notices.
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(SHM_SEND_TIMEOUT_MS);
+    while (!shm_ring_push(segment->responses, packet.data(), packet.size()))
+    {
+        if (std::chrono::steady_clock::now() > deadline)
+        {
+            std::cerr << "Detaching shared memory client " << reply.shm_client << ", its response ring is full\n";
+            // Leaves a generation the rank published meanwhile in place.
+            uint32_t generation = shm_generations[reply.shm_client];
+            entry.generation.compare_exchange_strong(generation, 0);
+            return;
+        }
+        shm_futex_wait(segment->responses.tail, segment->responses.tail.load(), 10);
+    }
+    shm_futex_wake(segment->responses.head);
+}
+
+bool WebGPUTcpListener::admit_round(int world_size)
+{
+    // Opening a round commits the listener to holding world_size slots
+    // until it completes.
+    size_t world = static_cast<size_t>(world_size);
+    if (slot_pool.available() < reserved_slots + world)
+    {
+        return false;
     }
+    reserved_slots += world - 1;
+    return true;
 }
 
-void WebGPUTcpListener::process_data(PacketHeader *header, std::vector<float> &payload, const sockaddr_in &client_addr)
+int32_t WebGPUTcpListener::credits(int world_size)
 {
-    
-    store().add_data(payload, client_addr);
+    // Every outstanding chunk of a rank may open a round of world_size
+    // contributions, so the free memory is shared out in those units.
+    size_t free_slots = slot_pool.available() - std::min(slot_pool.available(), reserved_slots);
+    size_t rounds = free_slots / std::max(world_size, 1);
+    return static_cast<int32_t>(std::max<size_t>(1, std::min<size_t>(MAX_CREDITS, rounds)));
+}
+
+void WebGPUTcpListener::send_backpressure(const ReplyEndpoint &reply, int32_t collective, int32_t offset,
+    int32_t dense_length, int32_t granted)
+{
+    ResponseHeader response;
+    response.contributors = htonl(0);
+    response.offset = htonl(offset);
+    response.payload_format = htonl(PAYLOAD_BACKPRESSURE);
+    response.data_length = htonl(0);
+    response.dense_length = htonl(dense_length);
+    response.credits = htonl(granted);
+    response.collective = htonl(collective);
+
+    std::vector<char> packet(sizeof(response));
+    memcpy(packet.data(), &response, sizeof(response));
+    send_result(reply, packet);
+}
+
+void WebGPUTcpListener::expire_rounds()
+{
+    auto now = std::chrono::steady_clock::now();
+    // Runs for every packet under load, the scan itself is throttled.
+    if (now - last_expiry_scan < std::chrono::milliseconds(100))
+    {
+        return;
+    }
+    last_expiry_scan = now;
+
+    struct Evicted
+    {
+        RoundKey key;
+        int32_t dense_length;
+        int world_size;
+        int32_t granted;
+        std::vector<ReplyEndpoint> clients;
+    };
+    std::vector<Evicted> evicted;
+    {
+        std::lock_guard<std::mutex> lock(rounds_mutex);
+        for (auto it = rounds.begin(); it != rounds.end();)
+        {
+            ReceivedDataContainer &round = it->second;
+            if (now - round.get_opened() < round_timeout)
+            {
+                ++it;
+                continue;
+            }
+
+            Evicted entry{it->first, round.get_dense_length(), round.get_world_size(), 0, {}};
+            for (const auto &contribution : round.get_data())
+            {
+                slot_pool.release(contribution.slot);
+                entry.clients.push_back(contribution.reply);
+            }
+            size_t missing = static_cast<size_t>(round.get_world_size() - round.get_size());
+            reserved_slots -= std::min(reserved_slots, missing);
+            evicted.push_back(std::move(entry));
+            it = rounds.erase(it);
+        }
+        // Granted once every evicted round's memory is back.
+        for (auto &entry : evicted)
+        {
+            entry.granted = credits(entry.world_size);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(completed_mutex);
+        while (!completed_order.empty() && now - completed_order.front().second >= round_timeout)
+        {
+            auto entry = completed_rounds.find(completed_order.front().first);
+            if (entry != completed_rounds.end() && entry->second.completed == completed_order.front().second)
+            {
+                completed_rounds.erase(entry);
+            }
+            completed_order.pop_front();
+        }
+    }
+
+    // The contributors send their chunk again, which reopens the round if
+    // the missing ranks are merely slow.
+    for (const auto &entry : evicted)
+    {
+        std::cerr << "Evicted incomplete round at offset " << entry.key.offset << " of allreduce "
+                  << entry.key.collective << " of group " << entry.key.group << " after "
+                  << round_timeout.count() << " ms\n";
+        for (const auto &client : entry.clients)
+        {
+            send_backpressure(client, entry.key.collective, entry.key.offset, entry.dense_length, entry.granted);
+        }
+    }
+}
+
+void WebGPUTcpListener::remember_completed(const RoundKey &key, const std::vector<ReplyEndpoint> &clients,
+    const std::vector<char> &packet)
+{
+    CompletedRound round;
+    round.completed = std::chrono::steady_clock::now();
+    round.packet = packet;
+    for (const auto &client : clients)
+    {
+        // Shared-memory results are never lost.
+        if (client.shm_client < 0)
+        {
+            round.clients.push_back(client.client_addr);
+        }
+    }
+    if (round.clients.empty())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(completed_mutex);
+    completed_order.emplace_back(key, round.completed);
+    completed_rounds[key] = std::move(round);
+}
+
+bool WebGPUTcpListener::find_completed(const RoundKey &key, const ReplyEndpoint &reply, std::vector<char> &packet)
+{
+    if (reply.shm_client >= 0)
+    {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(completed_mutex);
+    auto entry = completed_rounds.find(key);
+    if (entry == completed_rounds.end())
+    {
+        return false;
+    }
+    // Matching the sender's address and port keeps a restarted job, which
+    // reuses allreduce sequence numbers, from being served old results.
+    bool contributed = std::any_of(entry->second.clients.begin(), entry->second.clients.end(),
+        [&reply](const sockaddr_in &client)
+        {
+            return client.sin_addr.s_addr == reply.client_addr.sin_addr.s_addr &&
+                client.sin_port == reply.client_addr.sin_port;
+        });
+    if (contributed)
+    {
+        packet = entry->second.packet;
+    }
+    return contributed;
+}
+
+void WebGPUTcpListener::process_data(PacketHeader *header, const char *payload, const ReplyEndpoint &reply)
+{
+    std::unique_lock<std::mutex> lock(rounds_mutex);
+
+    if (header->payload_format == PAYLOAD_SPARSE)
+    {
+        const SparseEntry *entries = reinterpret_cast<const SparseEntry *>(payload);
+        for (int32_t i = 0; i < header->data_length; i++)
+        {
+            if (entries[i].index < 0 || entries[i].index >= header->dense_length)
+            {
+                std::cout << "Sparse index out of range\n";
+                return;
+            }
+        }
+    }
+
+    RoundKey key{header->group, header->collective, header->offset};
+
+    // Contributions to an open round are always admitted since their slots
+    // are reserved; only opening a new round can be refused.
+    auto existing = rounds.find(key);
+    if (existing == rounds.end())
+    {
+        std::vector<char> cached;
+        if (find_completed(key, reply, cached))
+        {
+            // A resend after the round completed; its result was lost or
+            // is still being aggregated and sent to the same address.
+            lock.unlock();
+            if (!cached.empty())
+            {
+                send_result(reply, cached);
+            }
+            return;
+        }
+        if (!admit_round(header->world_size))
+        {
+            int32_t granted = credits(header->world_size);
+            lock.unlock();
+            #ifdef DEBUG
+            std::cout << "Rejected chunk " << header->offset << " of rank " << header->rank << "\n";
+            #endif
+            send_backpressure(reply, header->collective, header->offset, header->dense_length, granted);
+            return;
+        }
+    }
+    else if (existing->second.has_rank(header->rank))
+    {
+        // A resend of a chunk whose first copy is already in the round; the
+        // round's result or eviction answers both.
+        #ifdef DEBUG
+        std::cout << "Duplicate chunk " << header->offset << " of rank " << header->rank << "\n";
+        #endif
+        return;
+    }
+    else if (reserved_slots > 0)
+    {
+        reserved_slots--;
+    }
+
+    uint32_t slot;
+    if (!slot_pool.acquire(slot))
+    {
+        // Only reachable if ranks disagree on the world size.
+        int32_t granted = credits(header->world_size);
+        lock.unlock();
+        send_backpressure(reply, header->collective, header->offset, header->dense_length, granted);
+        return;
+    }
+
+    memcpy(slot_pool.data(slot), payload, header->data_length * payload_entry_size(header->payload_format));
+
+    ReceivedDataContainer &round = store(key);
+    round.update_shape(header->world_size,
+        header->payload_format == PAYLOAD_DENSE ? header->data_length : header->dense_length);
+    round.add_data(header->rank, header->payload_format, header->data_length, slot, reply);
 
     #ifdef DEBUG
     std::cout << "Received data from rank " << header->rank << "\n";
     std::cout << "world_size: " << header->world_size << "\n";
     #endif
 
-    // current_received_size maybe lower than world_size 
+    // the round size maybe lower than world_size 
     // if we are receiving partial data
-    if (store().get_size() == header->world_size)
+    if (round.get_size() == round.get_world_size())
     {
+        if (header->payload_format == PAYLOAD_MANIFEST)
+        {
+            // Bitmaps are merged right away, they need no GPU work.
+            std::vector<ReplyEndpoint> clients;
+            std::vector<char> packet = merge_manifests(key, round, clients);
+            this->reset(key);
+            lock.unlock();
+            for (const auto &client : clients)
+            {
+                send_result(client, packet);
+            }
+            return;
+        }
+
         #ifdef DEBUG
         std::cout << "Aggregating data of type " << header->quantization_type << "\n";
         #endif
 
-        std::vector<T> result = aggregate_data<T>(store<T>().get_data());
+        // Hand the round to the GPU and start collecting the next one right
+        // away; the result is sent back from the compute poll thread.
+        aggregate_data(key, round);
 
-        // store the size of the result at the beginning, 
-        // this is used by the client to determine the size of the result in case of partial data
-        result.insert(result.begin(), static_cast<T>(store().get_size() - this->dropped_packets));
-
-        for (const auto &client : store().get_data())
-        {
-            sendto(sock_fd, result.data(), result.size() * sizeof(T), 0,
-                    (struct sockaddr *)&client.second, sizeof(client.second));
-        }
-
-        this->reset();
+        this->reset(key);
         
         #ifdef DEBUG
-        std::cout << "Sent result to all clients\n";
+        std::cout << "Submitted round for aggregation\n";
         #endif
     }
 }
 
-std::vector<float> WebGPUTcpListener::aggregate_data(const std::vector<std::pair<std::vector<float>, sockaddr_in>> &data)
+std::vector<char> WebGPUTcpListener::merge_manifests(const RoundKey &key, ReceivedDataContainer &round,
+    std::vector<ReplyEndpoint> &clients)
+{
+    std::vector<uint8_t> merged((round.get_dense_length() + 7) / 8, 0);
+    for (const auto &entry : round.get_data())
+    {
+        const uint8_t *bitmap = reinterpret_cast<const uint8_t *>(slot_pool.data(entry.slot));
+        size_t bytes = std::min<size_t>(entry.data_length, merged.size());
+        for (size_t i = 0; i < bytes; i++)
+        {
+            merged[i] |= bitmap[i];
+        }
+        slot_pool.release(entry.slot);
+        clients.push_back(entry.reply);
+    }
+
+    ResponseHeader response;
+    response.contributors = htonl(static_cast<int32_t>(clients.size()));
+    response.offset = htonl(key.offset);
+    response.payload_format = htonl(PAYLOAD_MANIFEST);
+    response.data_length = htonl(static_cast<int32_t>(merged.size()));
+    response.dense_length = htonl(round.get_dense_length());
+    response.credits = htonl(credits(round.get_world_size()));
+    response.collective = htonl(key.collective);
+
+    std::vector<char> packet(sizeof(response) + merged.size());
+    memcpy(packet.data(), &response, sizeof(response));
+    memcpy(packet.data() + sizeof(response), merged.data(), merged.size());
+
+    remember_completed(key, clients, packet);
+    return packet;
+}
+
+void WebGPUTcpListener::aggregate_data(const RoundKey &key, ReceivedDataContainer &round)
 {
+    const auto &data = round.get_data();
+    int32_t dense_length = round.get_dense_length();
+
     #ifdef DEBUG
     std::cout << "Aggregating " << data.size() << " data chunks\n";
     #endif
 
-    std::vector<float> result(data[0].first.size());
+    std::vector<std::vector<float>> dense;
+    std::vector<SparseContribution> sparse;
+    std::vector<ReplyEndpoint> clients;
+    clients.reserve(data.size());
+    for (const auto &entry : data)
+    {
+        const char *stored = slot_pool.data(entry.slot);
+        if (entry.payload_format == PAYLOAD_SPARSE)
+        {
+            const SparseEntry *entries = reinterpret_cast<const SparseEntry *>(stored);
+            SparseContribution contribution;
+            contribution.indices.reserve(entry.data_length);
+            contribution.values.reserve(entry.data_length);
+            for (int32_t i = 0; i < entry.data_length; i++)
+            {
+                contribution.indices.push_back(static_cast<uint32_t>(entries[i].index));
+                contribution.values.push_back(entries[i].value);
+            }
+            sparse.push_back(std::move(contribution));
+        }
+        else
+        {
+            // Ranks may send a shorter dense chunk than the round's length.
+            const float *values = reinterpret_cast<const float *>(stored);
+            dense.emplace_back(values, values + entry.data_length);
+            dense.back().resize(dense_length, 0.0f);
+        }
+        slot_pool.release(entry.slot);
+        clients.push_back(entry.reply);
+    }
+
+    int32_t contributors = static_cast<int32_t>(data.size() - this->dropped_packets);
+    // Granted with the result, after this round's slots have been returned.
+    int32_t granted = credits(round.get_world_size());
+    remember_completed(key, clients, {});
+
+    webgpu_compute.perform_sparse_aggregation_async(dense_length, std::move(dense), std::move(sparse),
+        [this, key, contributors, granted, clients = std::move(clients)](std::vector<float> result, std::exception_ptr error)
+        {
+            if (error)
+            {
+                try { std::rethrow_exception(error); }
+                catch (const std::exception &e) { std::cerr << "Aggregation failed: " << e.what() << "\n"; }
+                return;
+            }
+
+            // The response header carries the number of contributors,
+            // this is used by the client to determine the size of the result in case of partial data
+            std::vector<char> packet = encode_result(result, contributors, key.collective, key.offset, granted);
 
-    webgpu_compute.perform_aggregation(data, this->current_world_size);
+            {
+                std::lock_guard<std::mutex> lock(completed_mutex);
+                auto completed = completed_rounds.find(key);
+                if (completed != completed_rounds.end() && completed->second.packet.empty())
+                {
+                    completed->second.packet = packet;
+                }
+            }
 
-    return result;
+            for (const auto &client : clients)
+            {
+                send_result(client, packet);
+            }
+        });
 }
 
-void WebGPUTcpListener::reset()
+void WebGPUTcpListener::reset(const RoundKey &key)
 {
-    this->received_data_quantized_8bit.clear();
-    this->received_data_quantized_32bit.clear();
-    this->received_data_unquantized.clear();
+    this->rounds.erase(key);
 
     this->previous_quantization_type = -1;
-    this->current_world_size = 0;
-    this->current_received_size = 0;
 }
 
 void WebGPUTcpListener::run()
 {
-    std::cout << "Server listening on port " << ntohs(server_addr.sin_port) << "\n";
+    std::cout << "Server listening on port " << ntohs(server_addr.sin_port)
+              << (shm_running ? " (shared memory enabled)" : "")
+              << ", " << slot_pool.capacity() << " contribution slots\n";
     handle_packet();
 }
\ No newline at end of file
@@ -0,0 +1,889 @@
+#include "webgpu_listener_client.hpp"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <numeric>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+namespace c10d
+{
+
+  ListenerTransport parse_listener_transport(const std::string &name)
+  {
+    if (name.empty() || name == "auto") return ListenerTransport::AUTO;
+    if (name == "udp") return ListenerTransport::UDP;
+    if (name == "shm") return ListenerTransport::SHM;
+    throw std::invalid_argument("Unknown listener transport: " + name);
+  }
+
+  std::vector<ListenerEndpoint> parse_listener_endpoints(const std::string &endpoints)
+  {
+    std::vector<ListenerEndpoint> parsed;
+    size_t start = 0;
+    while (start <= endpoints.size())
+    {
+      size_t end = endpoints.find(',', start);
+      if (end == std::string::npos)
+      {
+        end = endpoints.size();
+      }
+      std::string endpoint = endpoints.substr(start, end - start);
+      size_t colon = endpoint.rfind(':');
+      if (colon == std::string::npos || colon == 0 || colon + 1 == endpoint.size())
+      {
+        throw std::invalid_argument("Listener endpoint must be host:port, got '" + endpoint + "'");
+      }
+      parsed.push_back({endpoint.substr(0, colon), std::stoi(endpoint.substr(colon + 1))});
+      start = end + 1;
+    }
+    return parsed;
+  }
+
+  std::string format_listener_endpoints(const std::vector<ListenerEndpoint> &endpoints)
+  {
+    std::string formatted;
+    for (const auto &endpoint : endpoints)
+    {
+      if (!formatted.empty())
+      {
+        formatted += ",";
+      }
+      formatted += endpoint.host + ":" + std::to_string(endpoint.port);
+    }
+    return formatted;
+  }
+
+  // Accepts hostnames as well as dotted addresses; the listener only binds
+  // IPv4.
+  static sockaddr_in resolve_listener_address(const std::string &host, int port)
+  {
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    struct addrinfo *resolved = nullptr;
+    int status = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &resolved);
+    if (status != 0)
+    {
+      throw std::invalid_argument("Cannot resolve listener address " + host + ": " + gai_strerror(status));
+    }
+    sockaddr_in address;
+    memcpy(&address, resolved->ai_addr, sizeof(address));
+    freeaddrinfo(resolved);
+    return address;
+  }
+
+  ListenerEndpoint resolve_listener_endpoint(const ListenerEndpoint &endpoint)
+  {
+    sockaddr_in address = resolve_listener_address(endpoint.host, endpoint.port);
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+    return {host, endpoint.port};
+  }
+
+  WebGPUListenerClient::WebGPUListenerClient(const std::string &host, int port, int rank, int world_size,
+      std::chrono::milliseconds timeout, ListenerTransport transport, uint32_t group)
+      : m_rank(rank),
+        m_world_size(world_size),
+        m_timeout(timeout),
+        m_group(group),
+        m_port(port)
+  {
+    server_addr = resolve_listener_address(host, port);
+
+    sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock_fd < 0)
+    {
+      throw std::runtime_error("Failed to create socket");
+    }
+
+    // Shared memory only reaches a listener on this host.
+    bool loopback = (ntohl(server_addr.sin_addr.s_addr) >> 24) == 127;
+    if (transport == ListenerTransport::SHM ||
+        (transport == ListenerTransport::AUTO && loopback))
+    {
+      if (!attach_shm(port) && transport == ListenerTransport::SHM)
+      {
+        close(sock_fd);
+        throw std::runtime_error("Listener on port " + std::to_string(port) + " does not expose shared memory");
+      }
+    }
+  }
+
+  WebGPUListenerClient::~WebGPUListenerClient()
+  {
+    if (m_shm_segment.valid())
+    {
+      auto *control = m_shm_control.as<ShmControlSegment>();
+      ShmClient &entry = control->clients[m_shm_client];
+      int32_t pid = getpid();
+      if (entry.pid.load(std::memory_order_acquire) == pid &&
+          entry.owner.load(std::memory_order_acquire) == shm_client_id(m_group, m_rank))
+      {
+        entry.generation.store(0, std::memory_order_release);
+        entry.owner.store(0, std::memory_order_release);
+        entry.pid.store(0, std::memory_order_release);
+      }
+      control->doorbell.fetch_add(1, std::memory_order_release);
+      shm_futex_wake(control->doorbell);
+    }
+    close(sock_fd);
+  }
+
+  static bool process_alive(int32_t pid)
+  {
+    return kill(pid, 0) == 0 || errno == EPERM;
+  }
+
+  bool WebGPUListenerClient::attach_shm(int port)
+  {
+    if (m_rank < 0)
+    {
+      return false;
+    }
+
+    m_shm_control = ShmRegion::open(shm_control_name(port), sizeof(ShmControlSegment));
+    auto *control = m_shm_control.as<ShmControlSegment>();
+    if (!m_shm_control.valid() || control->magic != SHM_MAGIC)
+    {
+      m_shm_control = ShmRegion();
+      return false;
+    }
+
+    // Keeps the entry this client held if the listener merely detached it,
+    // otherwise claims a free one or one whose process died.
+    int32_t pid = getpid();
+    uint64_t owner = shm_client_id(m_group, m_rank);
+    int claimed = -1;
+    for (int client = 0; client < SHM_MAX_CLIENTS && claimed < 0; client++)
+    {
+      ShmClient &entry = control->clients[client];
+      if (entry.pid.load(std::memory_order_acquire) == pid && entry.owner.load(std::memory_order_acquire) == owner)
+      {
+        claimed = client;
+      }
+    }
+    for (int client = 0; client < SHM_MAX_CLIENTS && claimed < 0; client++)
+    {
+      ShmClient &entry = control->clients[client];
+      int32_t holder = entry.pid.load(std::memory_order_acquire);
+      if ((holder == 0 || !process_alive(holder)) && entry.pid.compare_exchange_strong(holder, pid))
+      {
+        // Unpublished until the segment below exists.
+        entry.generation.store(0, std::memory_order_release);
+        entry.owner.store(owner, std::memory_order_release);
+        claimed = client;
+      }
+    }
+    if (claimed < 0)
+    {
+      m_shm_control = ShmRegion();
+      return false;
+    }
+
+    m_shm_client = claimed;
+    m_shm_segment = ShmRegion::create(shm_client_name(port, owner), sizeof(ShmRankSegment));
+    auto *segment = m_shm_segment.as<ShmRankSegment>();
+    segment->magic = SHM_MAGIC;
+    segment->group = m_group;
+    segment->rank = m_rank;
+
+    // A new generation makes the listener remap the segment even if this
+    // client was attached before.
+    ShmClient &entry = control->clients[claimed];
+    uint32_t generation = std::max<uint32_t>(m_shm_generation, entry.generation.load(std::memory_order_relaxed)) + 1;
+    m_shm_generation = generation == 0 ? 1 : generation;
+    entry.generation.store(m_shm_generation, std::memory_order_release);
+    return true;
+  }
+
+  void WebGPUListenerClient::recover_shm()
+  {
+    auto *attached = m_shm_control.as<ShmControlSegment>();
+    ShmRegion current = ShmRegion::open(shm_control_name(m_port), sizeof(ShmControlSegment));
+    auto *control = current.as<ShmControlSegment>();
+    bool restarted = !current.valid() || control->magic != SHM_MAGIC ||
+        control->incarnation != attached->incarnation;
+    ShmClient &entry = attached->clients[m_shm_client];
+    bool detached = entry.generation.load(std::memory_order_acquire) != m_shm_generation ||
+        entry.owner.load(std::memory_order_acquire) != shm_client_id(m_group, m_rank);
+    if (!restarted && !detached)
+    {
+      return;
+    }
+
+    // The rank segment is unlinked here; a fresh one is created on attach.
+    m_shm_segment = ShmRegion();
+    m_shm_control = ShmRegion();
+    m_shm_client = -1;
+    attach_shm(m_port);
+  }
+
+  void WebGPUListenerClient::allreduce(std::vector<float> &data, bool skip_zero_chunks)
+  {
+    std::vector<size_t> chunks((data.size() + SIZE_OF_CHUNK - 1) / SIZE_OF_CHUNK);
+    std::iota(chunks.begin(), chunks.end(), 0);
+    allreduce(data, chunks, skip_zero_chunks);
+  }
+
+  void WebGPUListenerClient::allreduce(std::vector<float> &data, const std::vector<size_t> &chunks,
+      bool skip_zero_chunks)
+  {
+    if (!skip_zero_chunks)
+    {
+      exchange_chunks(data, chunks);
+      return;
+    }
+
+    // Chunks that are zero on every rank are left out, so their result,
+    // zero, is already in place.
+    std::vector<uint8_t> present = exchange_manifests(data, chunks);
+    std::vector<size_t> needed;
+    for (size_t i = 0; i < chunks.size(); i++)
+    {
+      if (present[i / 8] & (1u << (i % 8)))
+      {
+        needed.push_back(chunks[i]);
+      }
+    }
+    m_skipped_chunks += chunks.size() - needed.size();
+    exchange_chunks(data, needed);
+  }
+
+  void WebGPUListenerClient::exchange_chunks(std::vector<float> &data, const std::vector<size_t> &chunks)
+  {
+    exchange(chunks.size(),
+        [&](size_t item, char *buffer)
+        {
+          size_t offset = chunks[item] * SIZE_OF_CHUNK;
+          int32_t length = static_cast<int32_t>(std::min<size_t>(SIZE_OF_CHUNK, data.size() - offset));
+          return encode_chunk(buffer, data.data() + offset, length, static_cast<int32_t>(offset));
+        },
+        [&](const char *buffer, size_t size, size_t &item)
+        {
+          int32_t offset;
+          ChunkResult result = decode_result(buffer, size, data, offset);
+          // Chunks are listed in ascending order.
+          size_t chunk = static_cast<size_t>(offset) / SIZE_OF_CHUNK;
+          auto position = std::lower_bound(chunks.begin(), chunks.end(), chunk);
+          if (position == chunks.end() || *position != chunk)
+          {
+            return ChunkResult::STALE;
+          }
+          item = static_cast<size_t>(position - chunks.begin());
+          return result;
+        });
+  }
+
+  std::vector<uint8_t> WebGPUListenerClient::exchange_manifests(const std::vector<float> &data,
+      const std::vector<size_t> &chunks)
+  {
+    // Bit i of the union is set if chunks[i] holds a non-zero on any rank.
+    std::vector<uint8_t> present((chunks.size() + 7) / 8, 0);
+    size_t spans = (chunks.size() + MANIFEST_CHUNKS - 1) / MANIFEST_CHUNKS;
+    exchange(spans,
+        [&](size_t span, char *buffer)
+        {
+          return encode_manifest(buffer, data, chunks, span);
+        },
+        [&](const char *buffer, size_t size, size_t &span)
+        {
+          return decode_manifest(buffer, size, present, span);
+        });
+    return present;
+  }
+
+  void WebGPUListenerClient::exchange(size_t items,
+      const std::function<size_t(size_t item, char *buffer)> &encode,
+      const std::function<ChunkResult(const char *buffer, size_t size, size_t &item)> &decode)
+  {
+    // Items go out in order, at most m_credits of them unanswered at a
+    // time. An item the listener had no memory for goes to the back of the
+    // queue so this rank keeps feeding the rounds that are already open.
+    m_collective++;
+    std::deque<size_t> pending(items);
+    std::iota(pending.begin(), pending.end(), 0);
+
+    // Unanswered items. Over UDP an item is sent again
+    // when its timer runs out, with the interval doubling every time; the
+    // listener ignores copies it already has and answers copies of
+    // completed rounds with their result.
+    struct InFlight
+    {
+      std::chrono::steady_clock::time_point resend_at;
+      std::chrono::milliseconds interval;
+    };
+    std::unordered_map<size_t, InFlight> in_flight;
+
+    size_t completed = 0;
+    auto backoff = std::chrono::milliseconds(0);
+    auto resume = std::chrono::steady_clock::now();
+    auto deadline = std::chrono::steady_clock::now() + m_timeout;
+    char buffer[MAX_DATAGRAM_SIZE];
+
+    auto send_item = [&](size_t item)
+    {
+      return transmit(buffer, encode(item, buffer));
+    };
+
+    while (completed < items)
+    {
+      // The response rings hold SHM_RING_SLOTS results per rank.
+      size_t window = uses_shm() ? std::min<size_t>(m_credits, SHM_RING_SLOTS) : static_cast<size_t>(m_credits);
+      auto now = std::chrono::steady_clock::now();
+
+      bool transmitted = false;
+      while (!pending.empty() && in_flight.size() < window && now >= resume)
+      {
+        if (!send_item(pending.front()))
+        {
+          break;
+        }
+        in_flight[pending.front()] = {now + std::chrono::milliseconds(CHUNK_RESEND_INITIAL_MS),
+            std::chrono::milliseconds(CHUNK_RESEND_INITIAL_MS)};
+        pending.pop_front();
+        transmitted = true;
+      }
+      if (transmitted)
+      {
+        flush();
+      }
+
+      if (in_flight.empty())
+      {
+        // Everything left was turned away; wait out the backoff.
+        if (now > deadline)
+        {
+          throw std::runtime_error("Timed out waiting for the listener to admit chunks");
+        }
+        std::this_thread::sleep_until(resume);
+        continue;
+      }
+
+      auto wait_until = deadline;
+      if (!uses_shm())
+      {
+        for (auto &[item, state] : in_flight)
+        {
+          if (state.resend_at <= now)
+          {
+            send_item(item);
+            m_resent_chunks++;
+            state.interval = std::min(state.interval * 2, std::chrono::milliseconds(CHUNK_RESEND_MAX_MS));
+            state.resend_at = now + state.interval;
+          }
+          wait_until = std::min(wait_until, state.resend_at);
+        }
+      }
+
+      size_t size = receive(buffer, wait_until);
+      if (size == 0)
+      {
+        if (std::chrono::steady_clock::now() > deadline)
+        {
+          throw std::runtime_error("Timed out waiting for aggregated chunks");
+        }
+        continue;
+      }
+
+      size_t item;
+      ChunkResult result = decode(buffer, size, item);
+      if (result == ChunkResult::STALE)
+      {
+        continue;
+      }
+
+      // With resends an item can be answered more than once, and a result
+      // can arrive after a rejection of another copy already requeued it.
+      if (result == ChunkResult::COMPLETED)
+      {
+        auto queued = std::find(pending.begin(), pending.end(), item);
+        if (in_flight.erase(item) == 0)
+        {
+          if (queued == pending.end())
+          {
+            continue;
+          }
+          pending.erase(queued);
+        }
+        // Rejections do not count as progress, a listener that stays out of
+        // memory fails the collective after m_timeout.
+        deadline = std::chrono::steady_clock::now() + m_timeout;
+        completed++;
+        backoff = std::chrono::milliseconds(0);
+        continue;
+      }
+
+      if (in_flight.erase(item) == 0)
+      {
+        continue;
+      }
+      m_backpressure_events++;
+      pending.push_back(item);
+      backoff = std::min(std::max(backoff * 2, std::chrono::milliseconds(1)), std::chrono::milliseconds(100));
+      resume = std::chrono::steady_clock::now() + backoff;
+    }
+  }
+
+  bool WebGPUListenerClient::transmit(const char *buffer, size_t size)
+  {
+    if (uses_shm())
+    {
+      if (!shm_ring_push(m_shm_segment.as<ShmRankSegment>()->requests, buffer, size))
+      {
+        return false;
+      }
+    }
+    else if (sendto(sock_fd, buffer, size, 0,
+                 (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0)
+    {
+      throw std::runtime_error(std::string("Failed to send chunk: ") + strerror(errno));
+    }
+    m_bytes_sent += size;
+    return true;
+  }
+
+  void WebGPUListenerClient::flush()
+  {
+    if (uses_shm())
+    {
+      auto *control = m_shm_control.as<ShmControlSegment>();
+      control->doorbell.fetch_add(1, std::memory_order_release);
+      shm_futex_wake(control->doorbell);
+    }
+  }
+
+  size_t WebGPUListenerClient::receive(char *buffer, std::chrono::steady_clock::time_point deadline)
+  {
+    if (!uses_shm())
+    {
+      auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+      struct pollfd readable = {sock_fd, POLLIN, 0};
+      if (poll(&readable, 1, static_cast<int>(std::max<int64_t>(0, remaining.count()))) == 0)
+      {
+        return 0;
+      }
+      ssize_t bytes_received = recv(sock_fd, buffer, MAX_DATAGRAM_SIZE, 0);
+      if (bytes_received < 0)
+      {
+        throw std::runtime_error(std::string("Failed to receive aggregated chunk: ") + strerror(errno));
+      }
+      m_bytes_received += bytes_received;
+      return static_cast<size_t>(bytes_received);
+    }
+
+    auto *segment = m_shm_segment.as<ShmRankSegment>();
+    while (true)
+    {
+      uint32_t head = segment->responses.head.load(std::memory_order_acquire);
+      uint32_t length;
+      if (shm_ring_pop(segment->responses, buffer, length))
+      {
+        m_bytes_received += length;
+        return length;
+      }
+      if (std::chrono::steady_clock::now() > deadline)
+      {
+        // The collective is lost either way, but the next one works again
+        // if the listener restarted or dropped this rank.
+        recover_shm();
+        throw std::runtime_error("Timed out waiting for aggregated chunks over shared memory");
+      }
+      shm_futex_wait(segment->responses.head, head, 10);
+    }
+  }
+
+  size_t WebGPUListenerClient::encode_chunk(char *buffer, const float *chunk, int32_t length, int32_t offset)
+  {
+    int32_t non_zero = static_cast<int32_t>(std::count_if(chunk, chunk + length,
+        [](float value) { return value != 0.0f; }));
+    bool sparse = prefer_sparse_encoding(non_zero, length);
+
+    PacketHeader header;
+    header.data_length = htonl(sparse ? non_zero : length);
+    header.rank = htonl(m_rank);
+    header.world_size = htonl(m_world_size);
+    header.offset = htonl(offset);
+    header.bit_width = htonl(32);
+    header.quantization_type = htonl(0);
+    header.payload_format = htonl(sparse ? PAYLOAD_SPARSE : PAYLOAD_DENSE);
+    header.dense_length = htonl(length);
+    header.collective = htonl(m_collective);
+    header.group = htonl(m_group);
+
+    memcpy(buffer, &header, sizeof(header));
+    size_t packet_size = sizeof(header);
+
+    if (sparse)
+    {
+      SparseEntry *entries = reinterpret_cast<SparseEntry *>(buffer + sizeof(header));
+      for (int32_t i = 0; i < length; i++)
+      {
+        if (chunk[i] != 0.0f)
+        {
+          *entries++ = {i, chunk[i]};
+        }
+      }
+      packet_size += non_zero * sizeof(SparseEntry);
+    }
+    else
+    {
+      memcpy(buffer + sizeof(header), chunk, length * sizeof(float));
+      packet_size += length * sizeof(float);
+    }
+
+    return packet_size;
+  }
+
+  WebGPUListenerClient::ChunkResult WebGPUListenerClient::decode_result(const char *buffer, size_t size,
+      std::vector<float> &data, int32_t &offset)
+  {
+    if (size < sizeof(ResponseHeader))
+    {
+      throw std::runtime_error("Aggregated chunk too small");
+    }
+
+    ResponseHeader header;
+    memcpy(&header, buffer, sizeof(header));
+    offset = ntohl(header.offset);
+    int32_t payload_format = ntohl(header.payload_format);
+    int32_t data_length = ntohl(header.data_length);
+    int32_t dense_length = ntohl(header.dense_length);
+    m_credits = std::max<int32_t>(1, std::min<int32_t>(ntohl(header.credits), MAX_CREDITS));
+    if (static_cast<int32_t>(ntohl(header.collective)) != m_collective)
+    {
+      return ChunkResult::STALE;
+    }
+
+    if (offset < 0 || offset % SIZE_OF_CHUNK != 0 || dense_length < 0 ||
+        static_cast<size_t>(offset) + dense_length > data.size())
+    {
+      throw std::runtime_error("Aggregated chunk at offset " + std::to_string(offset) +
+          " does not fit a payload of " + std::to_string(data.size()) + " elements");
+    }
+
+    if (payload_format == PAYLOAD_BACKPRESSURE)
+    {
+      return ChunkResult::REJECTED;
+    }
+
+    float *chunk = data.data() + offset;
+    const char *payload = buffer + sizeof(ResponseHeader);
+    if (payload_format == PAYLOAD_SPARSE)
+    {
+      if (data_length < 0 || size < sizeof(ResponseHeader) + data_length * sizeof(SparseEntry))
+      {
+        throw std::runtime_error("Aggregated chunk truncated");
+      }
+      std::fill(chunk, chunk + dense_length, 0.0f);
+      const SparseEntry *entries = reinterpret_cast<const SparseEntry *>(payload);
+      for (int32_t i = 0; i < data_length; i++)
+      {
+        if (entries[i].index < 0 || entries[i].index >= dense_length)
+        {
+          throw std::runtime_error("Aggregated chunk has an out of range index");
+        }
+        chunk[entries[i].index] = entries[i].value;
+      }
+    }
+    else
+    {
+      if (size < sizeof(ResponseHeader) + dense_length * sizeof(float))
+      {
+        throw std::runtime_error("Aggregated chunk truncated");
+      }
+      memcpy(chunk, payload, dense_length * sizeof(float));
+    }
+
+    return ChunkResult::COMPLETED;
+  }
+
+  size_t WebGPUListenerClient::encode_manifest(char *buffer, const std::vector<float> &data,
+      const std::vector<size_t> &chunks, size_t span)
+  {
+    size_t first = span * MANIFEST_CHUNKS;
+    size_t count = std::min<size_t>(MANIFEST_CHUNKS, chunks.size() - first);
+    int32_t bytes = static_cast<int32_t>((count + 7) / 8);
+
+    PacketHeader header;
+    header.data_length = htonl(bytes);
+    header.rank = htonl(m_rank);
+    header.world_size = htonl(m_world_size);
+    header.offset = htonl(static_cast<int32_t>(span));
+    header.bit_width = htonl(1);
+    header.quantization_type = htonl(0);
+    header.payload_format = htonl(PAYLOAD_MANIFEST);
+    header.dense_length = htonl(static_cast<int32_t>(count));
+    header.collective = htonl(m_collective);
+    header.group = htonl(m_group);
+    memcpy(buffer, &header, sizeof(header));
+
+    uint8_t *bits = reinterpret_cast<uint8_t *>(buffer + sizeof(header));
+    memset(bits, 0, bytes);
+    for (size_t i = 0; i < count; i++)
+    {
+      size_t offset = chunks[first + i] * SIZE_OF_CHUNK;
+      size_t end = std::min(offset + SIZE_OF_CHUNK, data.size());
+      if (std::any_of(data.begin() + offset, data.begin() + end, [](float value) { return value != 0.0f; }))
+      {
+        bits[i / 8] |= static_cast<uint8_t>(1u << (i % 8));
+      }
+    }
+    return sizeof(header) + bytes;
+  }
+
+  WebGPUListenerClient::ChunkResult WebGPUListenerClient::decode_manifest(const char *buffer, size_t size,
+      std::vector<uint8_t> &present, size_t &span)
+  {
+    if (size < sizeof(ResponseHeader))
+    {
+      throw std::runtime_error("Chunk manifest too small");
+    }
+
+    ResponseHeader header;
+    memcpy(&header, buffer, sizeof(header));
+    int32_t offset = ntohl(header.offset);
+    int32_t payload_format = ntohl(header.payload_format);
+    int32_t data_length = ntohl(header.data_length);
+    m_credits = std::max<int32_t>(1, std::min<int32_t>(ntohl(header.credits), MAX_CREDITS));
+    if (static_cast<int32_t>(ntohl(header.collective)) != m_collective)
+    {
+      return ChunkResult::STALE;
+    }
+
+    size_t first_byte = static_cast<size_t>(offset) * MANIFEST_CHUNKS / 8;
+    if (offset < 0 || first_byte >= present.size())
+    {
+      throw std::runtime_error("Chunk manifest for unknown span " + std::to_string(offset));
+    }
+    span = static_cast<size_t>(offset);
+
+    if (payload_format == PAYLOAD_BACKPRESSURE)
+    {
+      return ChunkResult::REJECTED;
+    }
+    if (payload_format != PAYLOAD_MANIFEST || data_length < 0 ||
+        size < sizeof(ResponseHeader) + data_length)
+    {
+      throw std::runtime_error("Chunk manifest truncated");
+    }
+
+    size_t bytes = std::min<size_t>(data_length, present.size() - first_byte);
+    memcpy(present.data() + first_byte, buffer + sizeof(ResponseHeader), bytes);
+    return ChunkResult::COMPLETED;
+  }
+
+  // 64-bit finalizer of splitmix64, spreads consecutive chunk indices and
+  // virtual node numbers evenly over the ring.
+  static uint64_t mix_hash(uint64_t value)
+  {
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+  }
+
+  // FNV-1a, so endpoint hashes do not depend on the standard library.
+  static uint64_t hash_endpoint(const std::string &endpoint)
+  {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (unsigned char c : endpoint)
+    {
+      hash = (hash ^ c) * 0x100000001b3ULL;
+    }
+    return hash;
+  }
+
+  ShardWorker::ShardWorker() : m_thread(&ShardWorker::run, this)
+  {
+  }
+
+  ShardWorker::~ShardWorker()
+  {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_ready.notify_one();
+    m_thread.join();
+  }
+
+  std::future<void> ShardWorker::submit(std::function<void()> task)
+  {
+    std::packaged_task<void()> packaged(std::move(task));
+    std::future<void> result = packaged.get_future();
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_tasks.push_back(std::move(packaged));
+    }
+    m_ready.notify_one();
+    return result;
+  }
+
+  void ShardWorker::run()
+  {
+    while (true)
+    {
+      std::packaged_task<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_ready.wait(lock, [this] { return m_stopping || !m_tasks.empty(); });
+        if (m_tasks.empty())
+        {
+          return;
+        }
+        task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+      }
+      task();
+    }
+  }
+
+  ShardedListenerClient::ShardedListenerClient(const std::vector<ListenerEndpoint> &endpoints, int rank,
+      int world_size, std::chrono::milliseconds timeout, ListenerTransport transport, uint32_t group)
+  {
+    if (endpoints.empty())
+    {
+      throw std::invalid_argument("At least one listener endpoint is required");
+    }
+
+    // Hashing the resolved form keeps "localhost" and "127.0.0.1" on the
+    // same point of the ring.
+    for (const auto &endpoint : endpoints)
+    {
+      m_endpoints.push_back(resolve_listener_endpoint(endpoint));
+      std::string resolved = format_listener_endpoints({m_endpoints.back()});
+      for (size_t other = 0; other + 1 < m_endpoints.size(); other++)
+      {
+        if (format_listener_endpoints({m_endpoints[other]}) == resolved)
+        {
+          throw std::invalid_argument("Listener endpoints " + format_listener_endpoints({endpoints[other]}) +
+              " and " + format_listener_endpoints({endpoint}) + " are the same listener");
+        }
+      }
+    }
+
+    for (size_t shard = 0; shard < m_endpoints.size(); shard++)
+    {
+      m_shards.push_back(std::make_unique<WebGPUListenerClient>(
+          m_endpoints[shard].host, m_endpoints[shard].port, rank, world_size, timeout, transport, group));
+
+      // Virtual nodes even out the share of every listener.
+      uint64_t endpoint_hash = hash_endpoint(format_listener_endpoints({m_endpoints[shard]}));
+      for (uint64_t node = 0; node < LISTENER_VIRTUAL_NODES; node++)
+      {
+        m_ring.emplace_back(mix_hash(endpoint_hash ^ mix_hash(node)), shard);
+      }
+    }
+    std::sort(m_ring.begin(), m_ring.end());
+
+    for (size_t shard = 1; shard < m_shards.size(); shard++)
+    {
+      m_workers.push_back(std::make_unique<ShardWorker>());
+    }
+  }
+
+  std::string ShardedListenerClient::endpoint_set() const
+  {
+    std::vector<ListenerEndpoint> sorted = m_endpoints;
+    std::sort(sorted.begin(), sorted.end(), [](const ListenerEndpoint &a, const ListenerEndpoint &b)
+        { return std::make_pair(a.host, a.port) < std::make_pair(b.host, b.port); });
+    return format_listener_endpoints(sorted);
+  }
+
+  size_t ShardedListenerClient::shard_of(size_t chunk) const
+  {
+    auto point = std::lower_bound(m_ring.begin(), m_ring.end(),
+        std::make_pair(mix_hash(chunk), static_cast<size_t>(0)));
+    return point == m_ring.end() ? m_ring.front().second : point->second;
+  }
+
+  void ShardedListenerClient::allreduce(std::vector<float> &data, bool skip_zero_chunks)
+  {
+    if (m_shards.size() == 1)
+    {
+      m_shards[0]->allreduce(data, skip_zero_chunks);
+      return;
+    }
+
+    size_t chunks = (data.size() + SIZE_OF_CHUNK - 1) / SIZE_OF_CHUNK;
+    std::vector<std::vector<size_t>> assigned(m_shards.size());
+    for (size_t chunk = 0; chunk < chunks; chunk++)
+    {
+      assigned[shard_of(chunk)].push_back(chunk);
+    }
+
+    // Chunks keep their offset in `data`, so every shard writes its results
+    // in place and the payload is reassembled without a copy. The calling
+    // thread serves the first shard.
+    std::vector<std::future<void>> pending;
+    for (size_t shard = 1; shard < m_shards.size(); shard++)
+    {
+      if (!assigned[shard].empty())
+      {
+        pending.push_back(m_workers[shard - 1]->submit(
+            [this, &data, &assigned, shard, skip_zero_chunks]()
+            { m_shards[shard]->allreduce(data, assigned[shard], skip_zero_chunks); }));
+      }
+    }
+
+    std::exception_ptr error;
+    try
+    {
+      m_shards[0]->allreduce(data, assigned[0], skip_zero_chunks);
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+    for (auto &shard : pending)
+    {
+      try
+      {
+        shard.get();
+      }
+      catch (...)
+      {
+        if (!error)
+        {
+          error = std::current_exception();
+        }
+      }
+    }
+    if (error)
+    {
+      std::rethrow_exception(error);
+    }
+  }
+
+  size_t ShardedListenerClient::bytes_sent() const
+  {
+    size_t total = 0;
+    for (const auto &shard : m_shards)
+    {
+      total += shard->bytes_sent();
+    }
+    return total;
+  }
+
+  size_t ShardedListenerClient::bytes_received() const
+  {
+    size_t total = 0;
+    for (const auto &shard : m_shards)
+    {
+      total += shard->bytes_received();
+    }
+    return total;
+  }
+}
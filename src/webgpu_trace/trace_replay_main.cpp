@@ -0,0 +1,354 @@
+#include "webgpu_trace/webgpu_trace.hpp"
+#include "webgpu_listener_client.hpp"
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Replays collective traces recorded by WebGPUBackend against local
+// WebGPUTcpListener instances with simulated ranks, and reports the latency
+// distribution. Every simulated rank contributes ones, so each result must
+// equal the number of ranks. Only allreduces go through the listener, other
+// collectives are skipped and reported; their recorded time is still waited
+// out so the allreduces keep their spacing.
+
+struct ReplayOptions
+{
+    std::string host = "127.0.0.1";
+    int port = 30000;
+    // Shards chunks over several listeners, overrides host and port.
+    std::vector<c10d::ListenerEndpoint> endpoints;
+    int ranks = 0;
+    // Divides the recorded gaps; 0 replays back to back.
+    double speedup = 1.0;
+    bool processes = false;
+    c10d::ListenerTransport transport = c10d::ListenerTransport::AUTO;
+    // Keeps concurrent replays on the same listener apart, random by default.
+    uint32_t group = 0;
+    std::vector<std::string> traces;
+};
+
+struct ReplaySample
+{
+    uint64_t latency_ns;
+    uint64_t numel;
+    uint64_t mismatches;
+};
+
+static void usage(const char *argv0)
+{
+    std::cerr << "Usage: " << argv0 << " [--host <addr>] [--port <port>] [--endpoints <host:port,...>]"
+              << " [--ranks <n>] [--speedup <x>] [--processes] [--transport auto|udp|shm] [--group <id>]"
+              << " <trace>...\n"
+              << "  One trace per simulated rank, or a single trace replayed by --ranks ranks.\n"
+              << "  --endpoints shards every collective over several listeners.\n"
+              << "  --speedup 0 replays without the recorded gaps.\n";
+}
+
+static std::vector<ReplaySample> replay_rank(int rank, int world_size, const CollectiveTraceReader &trace,
+    const ReplayOptions &options)
+{
+    c10d::ShardedListenerClient client(options.endpoints, rank, world_size,
+        std::chrono::milliseconds(30000), options.transport, options.group);
+    std::vector<ReplaySample> samples;
+    samples.reserve(trace.records().size());
+
+    for (const auto &record : trace.records())
+    {
+        bool replayable = record.header.op == TRACE_OP_ALLREDUCE;
+        if (options.speedup > 0)
+        {
+            uint64_t idle_ns = record.header.gap_ns + (replayable ? 0 : record.header.duration_ns);
+            std::this_thread::sleep_for(std::chrono::nanoseconds(
+                static_cast<uint64_t>(idle_ns / options.speedup)));
+        }
+        if (!replayable)
+        {
+            continue;
+        }
+
+        std::vector<float> data(record.total_numel(), 1.0f);
+
+        auto start = std::chrono::steady_clock::now();
+        client.allreduce(data);
+        auto end = std::chrono::steady_clock::now();
+
+        uint64_t mismatches = std::count_if(data.begin(), data.end(),
+            [world_size](float value) { return value != static_cast<float>(world_size); });
+        samples.push_back({
+            static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()),
+            record.total_numel(),
+            mismatches});
+    }
+
+    return samples;
+}
+
+static std::vector<ReplaySample> replay_in_threads(const std::vector<std::unique_ptr<CollectiveTraceReader>> &traces,
+    const ReplayOptions &options, int world_size)
+{
+    std::vector<std::vector<ReplaySample>> per_rank(world_size);
+    std::vector<std::string> errors(world_size);
+    std::vector<std::thread> threads;
+
+    for (int rank = 0; rank < world_size; rank++)
+    {
+        const auto &trace = *traces[traces.size() == 1 ? 0 : rank];
+        threads.emplace_back([&, rank]() {
+            try
+            {
+                per_rank[rank] = replay_rank(rank, world_size, trace, options);
+            }
+            catch (const std::exception &e)
+            {
+                errors[rank] = e.what();
+            }
+        });
+    }
+
+    std::vector<ReplaySample> samples;
+    for (int rank = 0; rank < world_size; rank++)
+    {
+        threads[rank].join();
+        if (!errors[rank].empty())
+        {
+            std::cerr << "Rank " << rank << " failed: " << errors[rank] << "\n";
+        }
+        samples.insert(samples.end(), per_rank[rank].begin(), per_rank[rank].end());
+    }
+    return samples;
+}
+
+static std::vector<ReplaySample> replay_in_processes(const std::vector<std::unique_ptr<CollectiveTraceReader>> &traces,
+    const ReplayOptions &options, int world_size)
+{
+    std::vector<int> pipes;
+    std::vector<pid_t> children;
+
+    for (int rank = 0; rank < world_size; rank++)
+    {
+        int fds[2];
+        if (pipe(fds) < 0)
+        {
+            throw std::runtime_error("Failed to create pipe");
+        }
+
+        pid_t pid = fork();
+        if (pid < 0)
+        {
+            throw std::runtime_error("Failed to fork rank " + std::to_string(rank));
+        }
+        if (pid == 0)
+        {
+            close(fds[0]);
+            int status = 0;
+            std::vector<ReplaySample> samples;
+            try
+            {
+                samples = replay_rank(rank, world_size, *traces[traces.size() == 1 ? 0 : rank], options);
+            }
+            catch (const std::exception &e)
+            {
+                std::cerr << "Rank " << rank << " failed: " << e.what() << "\n";
+                status = 1;
+            }
+
+            uint64_t count = samples.size();
+            const char *data = reinterpret_cast<const char *>(samples.data());
+            size_t remaining = count * sizeof(ReplaySample);
+            write(fds[1], &count, sizeof(count));
+            while (remaining > 0)
+            {
+                ssize_t written = write(fds[1], data, remaining);
+                if (written <= 0)
+                {
+                    break;
+                }
+                data += written;
+                remaining -= written;
+            }
+            close(fds[1]);
+            _exit(status);
+        }
+
+        close(fds[1]);
+        pipes.push_back(fds[0]);
+        children.push_back(pid);
+    }
+
+    std::vector<ReplaySample> samples;
+    for (int rank = 0; rank < world_size; rank++)
+    {
+        uint64_t count = 0;
+        if (read(pipes[rank], &count, sizeof(count)) == sizeof(count))
+        {
+            std::vector<ReplaySample> rank_samples(count);
+            char *data = reinterpret_cast<char *>(rank_samples.data());
+            size_t remaining = count * sizeof(ReplaySample);
+            while (remaining > 0)
+            {
+                ssize_t received = read(pipes[rank], data, remaining);
+                if (received <= 0)
+                {
+                    break;
+                }
+                data += received;
+                remaining -= received;
+            }
+            if (remaining == 0)
+            {
+                samples.insert(samples.end(), rank_samples.begin(), rank_samples.end());
+            }
+        }
+        close(pipes[rank]);
+        waitpid(children[rank], nullptr, 0);
+    }
+    return samples;
+}
+
+// Every listener allreduce is sent as float32, so other dtypes replay with
+// the recorded element counts but not the recorded tensor bytes.
+static void report_skipped(const std::vector<std::unique_ptr<CollectiveTraceReader>> &traces)
+{
+    std::map<uint8_t, uint64_t> skipped;
+    uint64_t converted = 0;
+    for (const auto &trace : traces)
+    {
+        for (const auto &record : trace->records())
+        {
+            if (record.header.op != TRACE_OP_ALLREDUCE)
+            {
+                skipped[record.header.op]++;
+            }
+            else if (std::any_of(record.tensors.begin(), record.tensors.end(),
+                         [](const TraceTensor &tensor) { return tensor.dtype != TRACE_DTYPE_FLOAT32; }))
+            {
+                converted++;
+            }
+        }
+    }
+
+    for (const auto &entry : skipped)
+    {
+        std::cout << "Skipped:       " << entry.second << " records of c10d::OpType "
+                  << static_cast<int>(entry.first) << " (not replayable)\n";
+    }
+    if (converted > 0)
+    {
+        std::cout << "Converted:     " << converted << " allreduces of non-float32 tensors replayed as float32\n";
+    }
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void report(const std::vector<ReplaySample> &samples, double wall_seconds)
+{
+    if (samples.empty())
+    {
+        std::cout << "No collectives replayed\n";
+        return;
+    }
+
+    std::vector<uint64_t> latencies;
+    uint64_t total_numel = 0;
+    uint64_t mismatches = 0;
+    for (const auto &sample : samples)
+    {
+        latencies.push_back(sample.latency_ns);
+        total_numel += sample.numel;
+        mismatches += sample.mismatches;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    double mean = std::accumulate(latencies.begin(), latencies.end(), 0.0) / latencies.size();
+
+    auto us = [](double ns) { return ns / 1000.0; };
+    std::cout << "Collectives:   " << samples.size() << "\n"
+              << "Wall time:     " << wall_seconds << " s\n"
+              << "Throughput:    " << (total_numel * sizeof(float)) / wall_seconds / (1 << 20) << " MiB/s\n"
+              << "Latency (us):  min " << us(latencies.front())
+              << "  p50 " << us(percentile(latencies, 0.50))
+              << "  p90 " << us(percentile(latencies, 0.90))
+              << "  p99 " << us(percentile(latencies, 0.99))
+              << "  max " << us(latencies.back())
+              << "  mean " << us(mean) << "\n"
+              << "Mismatches:    " << mismatches << "\n";
+}
+
+int main(int argc, char *argv[])
+{
+    ReplayOptions options;
+    options.group = static_cast<uint32_t>(std::random_device()());
+
+    try
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "--host" && i + 1 < argc) options.host = argv[++i];
+            else if (arg == "--port" && i + 1 < argc) options.port = std::stoi(argv[++i]);
+            else if (arg == "--endpoints" && i + 1 < argc) options.endpoints = c10d::parse_listener_endpoints(argv[++i]);
+            else if (arg == "--ranks" && i + 1 < argc) options.ranks = std::stoi(argv[++i]);
+            else if (arg == "--speedup" && i + 1 < argc) options.speedup = std::stod(argv[++i]);
+            else if (arg == "--processes") options.processes = true;
+            else if (arg == "--transport" && i + 1 < argc) options.transport = c10d::parse_listener_transport(argv[++i]);
+            else if (arg == "--group" && i + 1 < argc) options.group = static_cast<uint32_t>(std::stoul(argv[++i]));
+            else if (arg.rfind("--", 0) == 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            else options.traces.push_back(arg);
+        }
+
+        if (options.traces.empty() || (options.traces.size() > 1 && options.ranks > 0 &&
+                options.ranks != static_cast<int>(options.traces.size())))
+        {
+            usage(argv[0]);
+            return 1;
+        }
+
+        if (options.endpoints.empty())
+        {
+            options.endpoints.push_back({options.host, options.port});
+        }
+
+        std::vector<std::unique_ptr<CollectiveTraceReader>> traces;
+        for (const auto &path : options.traces)
+        {
+            traces.push_back(std::make_unique<CollectiveTraceReader>(path));
+        }
+
+        int world_size = options.traces.size() > 1 ? static_cast<int>(options.traces.size())
+            : std::max(options.ranks, 1);
+
+        std::cout << "Replaying " << traces[0]->records().size() << " collectives with "
+                  << world_size << " ranks against " << c10d::format_listener_endpoints(options.endpoints) << "\n";
+
+        auto start = std::chrono::steady_clock::now();
+        auto samples = options.processes ? replay_in_processes(traces, options, world_size)
+            : replay_in_threads(traces, options, world_size);
+        std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+
+        report(samples, wall.count());
+        report_skipped(traces);
+    }
+    catch (const std::exception &e)
+    {
+        std::cout << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include "webgpu_trace/webgpu_trace.hpp"
+
+#include <stdexcept>
+
+static uint64_t to_ns(std::chrono::steady_clock::duration duration)
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+uint64_t TraceRecord::total_numel() const
+{
+    uint64_t total = 0;
+    for (const auto &tensor : tensors)
+    {
+        total += tensor.numel;
+    }
+    return total;
+}
+
+CollectiveTraceRecorder::CollectiveTraceRecorder(const std::string &path, int rank, int world_size)
+    : m_file(path, std::ios::binary | std::ios::trunc),
+      m_rank(rank)
+{
+    if (!m_file)
+    {
+        throw std::runtime_error("Failed to open trace file " + path);
+    }
+
+    TraceFileHeader header = {TRACE_MAGIC, TRACE_VERSION, rank, world_size};
+    m_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+}
+
+CollectiveTraceRecorder::~CollectiveTraceRecorder()
+{
+    flush();
+}
+
+void CollectiveTraceRecorder::record(uint8_t op, const std::vector<TraceTensor> &tensors,
+    std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_started)
+    {
+        m_origin = start;
+        m_previous_end = start;
+        m_started = true;
+    }
+
+    TraceRecordHeader header;
+    header.op = op;
+    if (tensors.size() > UINT32_MAX)
+    {
+        throw std::length_error("Collective has too many tensors to trace");
+    }
+    header.num_tensors = static_cast<uint32_t>(tensors.size());
+    header.rank = m_rank;
+    header.start_ns = to_ns(start - m_origin);
+    header.duration_ns = to_ns(end - start);
+    header.gap_ns = start > m_previous_end ? to_ns(start - m_previous_end) : 0;
+    m_previous_end = end;
+
+    m_file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    m_file.write(reinterpret_cast<const char *>(tensors.data()), header.num_tensors * sizeof(TraceTensor));
+}
+
+void CollectiveTraceRecorder::flush()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_file.flush();
+}
+
+CollectiveTraceReader::CollectiveTraceReader(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open trace file " + path);
+    }
+
+    if (!file.read(reinterpret_cast<char *>(&m_header), sizeof(m_header)) ||
+        m_header.magic != TRACE_MAGIC)
+    {
+        throw std::runtime_error(path + " is not a collective trace");
+    }
+    if (m_header.version != TRACE_VERSION)
+    {
+        throw std::runtime_error("Unsupported trace version " + std::to_string(m_header.version));
+    }
+
+    TraceRecord record;
+    while (file.read(reinterpret_cast<char *>(&record.header), sizeof(record.header)))
+    {
+        record.tensors.resize(record.header.num_tensors);
+        if (!file.read(reinterpret_cast<char *>(record.tensors.data()),
+                record.header.num_tensors * sizeof(TraceTensor)))
+        {
+            // A truncated last record means the job died mid-write, keep
+            // everything before it.
+            break;
+        }
+        m_records.push_back(record);
+    }
+}